@@ -0,0 +1,180 @@
+// memory hierarchy reference suite built on bench.h
+//
+// Measures, for working sets from 4 KiB to 4x the last-level cache:
+// - load-to-use latency by chasing pointers through randomly ordered cache lines
+// - read, write and copy bandwidth with SIMD loads/stores (AVX2 with -mavx2, SSE2 otherwise)
+// and prints them as one size-vs-latency curve.
+//
+//     cc -O2 -Iinclude example/memory.c -o memory -lm
+//     ./memory [max size in MiB]
+
+#include "bench.h"
+#include <immintrin.h>
+
+#define LINE 64
+#define CHASE_LOADS 1024   // dependent loads per sample
+#define MAX_SIZES 32
+
+enum { LATENCY, READ, WRITE, COPY, KINDS };
+
+// Filled by the reporter below: median ns per load, or bytes/s at the median
+static double table[KINDS][MAX_SIZES];
+static int current_kind, current_size;
+
+static void collect(FILE *out, const struct bench_result *r) {
+    (void)out;
+    double median = bench_result_percentile(r, 50);
+    if (current_kind == LATENCY)
+        table[LATENCY][current_size] = bench_result_ns(r, median) / r->items;
+    else
+        table[current_kind][current_size] = bench_result_rate(r, r->bytes, median);
+}
+
+static const struct bench_reporter memory_reporter = { "memory", NULL, collect, NULL };
+
+// Links the lines of buf into one random cycle (Sattolo's shuffle), so the
+// hardware prefetchers cannot guess the next address
+static void **build_chain(char *buf, size_t size) {
+    size_t lines = size / LINE;
+    size_t *order = malloc(lines * sizeof(size_t));
+    if (!order) {
+        fprintf(stderr, "cannot allocate %lu line indices\n", lines);
+        exit(1);
+    }
+    for (size_t i = 0; i < lines; i++)
+        order[i] = i;
+    for (size_t i = lines - 1; i > 0; i--) {
+        size_t j = (size_t)rand() % i;
+        size_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (size_t i = 0; i < lines; i++)
+        *(void **)(buf + order[i] * LINE) = buf + order[(i + 1) % lines] * LINE;
+    void **start = (void **)(buf + order[0] * LINE);
+    free(order);
+    return start;
+}
+
+#ifdef __AVX2__
+typedef __m256i vec;
+#define vec_load(p) _mm256_load_si256((const __m256i *)(p))
+#define vec_store(p, v) _mm256_store_si256((__m256i *)(p), v)
+#define vec_or(a, b) _mm256_or_si256(a, b)
+#define vec_zero() _mm256_setzero_si256()
+#define SIMD_NAME "AVX2"
+#else
+typedef __m128i vec;
+#define vec_load(p) _mm_load_si128((const __m128i *)(p))
+#define vec_store(p, v) _mm_store_si128((__m128i *)(p), v)
+#define vec_or(a, b) _mm_or_si128(a, b)
+#define vec_zero() _mm_setzero_si128()
+#define SIMD_NAME "SSE2"
+#endif
+
+// Four independent accumulators keep several loads in flight
+static void read_pass(const char *buf, size_t size) {
+    vec a = vec_zero(), b = vec_zero(), c = vec_zero(), d = vec_zero();
+    for (size_t i = 0; i < size; i += 4 * sizeof(vec)) {
+        a = vec_or(a, vec_load(buf + i));
+        b = vec_or(b, vec_load(buf + i + sizeof(vec)));
+        c = vec_or(c, vec_load(buf + i + 2 * sizeof(vec)));
+        d = vec_or(d, vec_load(buf + i + 3 * sizeof(vec)));
+    }
+    vec sum = vec_or(vec_or(a, b), vec_or(c, d));
+    bench_do_not_optimize(sum);
+}
+
+static void write_pass(char *buf, size_t size) {
+    vec v = vec_zero();
+    bench_opaque(v);
+    for (size_t i = 0; i < size; i += sizeof(vec))
+        vec_store(buf + i, v);
+    bench_clobber_memory();
+}
+
+static void copy_pass(char *dst, const char *src, size_t size) {
+    for (size_t i = 0; i < size; i += sizeof(vec))
+        vec_store(dst + i, vec_load(src + i));
+    bench_clobber_memory();
+}
+
+static void print_size(char *out, size_t len, uint64_t size) {
+    if (size >= (1u << 30))
+        snprintf(out, len, "%lu GiB", size >> 30);
+    else if (size >= (1u << 20))
+        snprintf(out, len, "%lu MiB", size >> 20);
+    else
+        snprintf(out, len, "%lu KiB", size >> 10);
+}
+
+int main(int argc, char **argv) {
+    uint64_t max = argc > 1 ? strtoull(argv[1], NULL, 10) << 20 : 4 * (uint64_t)bench_llc_size();
+    max = max > (1ull << 30) ? 1ull << 30 : max < 8192 ? 8192 : max;
+    uint64_t sizes[MAX_SIZES];
+    int nsizes = bench_range_values(sizes, MAX_SIZES, 4096, max, 2);
+
+    char *src = aligned_alloc(4096, max), *dst = aligned_alloc(4096, max);
+    if (!src || !dst) {
+        fprintf(stderr, "cannot allocate 2 x %lu bytes\n", max);
+        return 1;
+    }
+    memset(src, 1, max);
+    memset(dst, 2, max);
+
+    bench_config.reporter = &memory_reporter;
+    // Budget-only: every point gets the full time, the error target cannot cut it short
+    bench_config.budget_ms = 100;
+    bench_config.target_rse = 0;
+    bench_config.histogram = 1; // medians, so interrupts and page faults do not shift the curve
+    fprintf(stderr, "measuring %d sizes up to %lu MiB...\n", nsizes, max >> 20);
+
+    for (current_size = 0; current_size < nsizes; current_size++) {
+        size_t size = sizes[current_size];
+
+        void **p = build_chain(src, size);
+        current_kind = LATENCY;
+        bench_set_items(CHASE_LOADS);
+        BENCH("latency", {
+            for (int k = 0; k < CHASE_LOADS; k++)
+                p = (void **)*p;
+            bench_do_not_optimize(p);
+        }, BENCH_AUTO_ITERATIONS);
+
+        current_kind = READ;
+        bench_set_bytes(size);
+        BENCH_BATCH("read", { read_pass(src, size); }, BENCH_AUTO_ITERATIONS);
+
+        current_kind = WRITE;
+        bench_set_bytes(size);
+        BENCH_BATCH("write", { write_pass(dst, size); }, BENCH_AUTO_ITERATIONS);
+
+        // Both buffers count, as in STREAM
+        current_kind = COPY;
+        bench_set_bytes(2 * size);
+        BENCH_BATCH("copy", { copy_pass(dst, src, size); }, BENCH_AUTO_ITERATIONS);
+    }
+    bench_output_close();
+
+    const struct bench_host *host = bench_host();
+    printf("%s, LLC %lu MiB, %s loads\n\n", host->cpu, (uint64_t)bench_llc_size() >> 20, SIMD_NAME);
+    printf("%10s %10s  %-32s %10s %10s %10s\n", "Size", "Latency", "", "Read", "Write", "Copy");
+    printf("%10s %10s  %-32s %10s %10s %10s\n", "", "ns/load", "", "GiB/s", "GiB/s", "GiB/s");
+    double peak = 0;
+    for (int i = 0; i < nsizes; i++)
+        peak = table[LATENCY][i] > peak ? table[LATENCY][i] : peak;
+    for (int i = 0; i < nsizes; i++) {
+        char size[16];
+        print_size(size, sizeof(size), sizes[i]);
+        // Bars on a log scale, so the L1 plateau is still visible next to DRAM
+        int bar = peak > 1 && table[LATENCY][i] > 0 ? (int)(32 * log(table[LATENCY][i]) / log(peak) + 0.5) : 0;
+        bar = bar < 0 ? 0 : bar > 32 ? 32 : bar;
+        printf("%10s %10.2f  %-32.*s", size, table[LATENCY][i], bar, "################################");
+        for (int k = READ; k < KINDS; k++)
+            printf(" %10.2f", table[k][i] / (1 << 30));
+        printf("\n");
+    }
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -3,17 +3,19 @@
 #include "bench.h"
 
 void example() {
-    volatile int x = 0; // volatile prevents optimization
-    
     BENCH("Empty loop", {
         for(int i = 0; i < 1000; i++) {
-            x = i; // pseudo-load
+            bench_do_not_optimize(i); // keeps the loop, no store to memory
         }
     }, 1000);
 
     BENCH_RDTSC("CPU Cycles test", {
         asm("nop"); // precise measurement of one instruction
     }, 100000);
+
+    BENCH_RDTSC_BATCH("CPU Cycles test (batched)", {
+        asm("nop"); // runs many times per sample, reported per execution
+    }, 1000);
 }
 
 int main() {
@@ -6,6 +6,29 @@
  * Provides macros for measuring code execution time:
  * - BENCH(): Measures time in nanoseconds using clock_gettime()
  * - BENCH_RDTSC(): Measures CPU cycles using RDTSCP instruction
+ *   (converted to nanoseconds via a one-time TSC calibration)
+ *
+ * Most macros below also come as BENCH_RDTSC_*() variants:
+ * - BENCH_BATCH(): Times batches of executions for blocks near the timer floor
+ * - BENCH_AUTO(): Runs until a time budget or a relative standard error;
+ *   any macro also takes BENCH_AUTO_ITERATIONS as its iteration count
+ * - BENCH_SETUP(): Untimed setup and teardown around every execution
+ * - BENCH_COLD(): Hot and cold-cache passes, caches evicted between samples
+ * - BENCH_RANGE() / BENCH_RANGE2(): One result per parameter value, with a
+ *   complexity fit
+ * - BENCH_AB(): Two blocks interleaved in random order, paired B/A ratio
+ * - BENCH_PERF(): Adds hardware counters (perf_event_open) to the report
+ * - BENCH_RDPMC(): Core cycles and instructions read with RDPMC
+ * - BENCH_THREADS() / BENCH_SCALING(): Pinned threads released together,
+ *   and sweeps over thread counts with Amdahl / USL fits (inline blocks
+ *   need C++; in C use BENCH_THREADS_FN() / BENCH_SCALING_FN() with a
+ *   thread function built on BENCH_THREAD_LOOP())
+ * - BENCH_CASE() / BENCH_MAIN(): Registered cases run by bench_main(),
+ *   which parses command-line options (--help lists them)
+ *
+ * Settings live in the global bench_config (budget, warmup, recording,
+ * histogram, reporter and output, baselines, pinning); set fields before
+ * running a benchmark.
  * 
  * Features:
  * - Memory barriers to prevent instruction reordering
@@ -23,6 +46,2299 @@
 #include <time.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <regex.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <pthread.h>
+
+/*
+* Process-wide state. Weak definitions let every translation unit that
+* includes bench.h share one copy without a separate .c file.
+*/
+#define _BENCH_SHARED __attribute__((weak))
+
+/*
+* Optimization barriers for benchmarked code.
+*
+* bench_do_not_optimize(x) - the compiler must assume x is read, so the
+* code computing it cannot be removed. A value already in a register
+* stays there ("r,m"), no store is forced. The memory clobber also makes
+* pending writes to globals and through escaped pointers happen.
+*
+* bench_clobber_memory() - the compiler must assume all memory is read
+* and written here: earlier stores are not dropped, later loads are not
+* hoisted above it.
+*
+* In C++ non-const lvalues are treated as read and written, so their
+* value cannot be constant-folded into later uses either; small trivially
+* copyable values may stay in a register, anything else goes through
+* memory. In C the same is available as bench_opaque(x) for lvalues.
+*/
+#ifdef __cplusplus
+#include <type_traits>
+
+static inline void bench_clobber_memory() {
+    asm volatile ("" ::: "memory");
+}
+
+template <class T> static inline void bench_do_not_optimize(const T &value) {
+    asm volatile ("" : : "r,m" (value) : "memory");
+}
+
+template <class T>
+static inline typename std::enable_if<std::is_trivially_copyable<T>::value && sizeof(T) <= sizeof(T *)>::type
+bench_do_not_optimize(T &value) {
+    asm volatile ("" : "+m,r" (value) : : "memory");
+}
+
+template <class T>
+static inline typename std::enable_if<!(std::is_trivially_copyable<T>::value && sizeof(T) <= sizeof(T *))>::type
+bench_do_not_optimize(T &value) {
+    asm volatile ("" : "+m" (value) : : "memory");
+}
+
+template <class T> static inline void bench_opaque(T &value) {
+    bench_do_not_optimize(value);
+}
+#else
+#define bench_clobber_memory() asm volatile ("" ::: "memory")
+#define bench_do_not_optimize(x) asm volatile ("" : : "r,m" (x) : "memory")
+#define bench_opaque(x) asm volatile ("" : "+m,r" (x) : : "memory")
+#endif
+
+/* Length of one TSC calibration window in milliseconds */
+#ifndef BENCH_TSC_CALIBRATION_MS
+#define BENCH_TSC_CALIBRATION_MS 10
+#endif
+
+/* Nanoseconds per TSC tick, 0 until bench_tsc_calibrate() has run */
+_BENCH_SHARED double _bench_tsc_ns_per_cycle = 0.0;
+
+/* Current CLOCK_MONOTONIC_RAW time in nanoseconds */
+static inline uint64_t _bench_clock_ns(void) {
+    struct timespec _ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &_ts);
+    return (uint64_t)_ts.tv_sec * 1000000000ULL + (uint64_t)_ts.tv_nsec;
+}
+
+/*
+* Reads the TSC with RDTSCP. RDTSCP waits for all previous instructions
+* to retire before reading the counter. The processor ID it returns in
+* ECX is stored to *cpu when cpu is not NULL.
+*/
+static inline uint64_t _bench_rdtscp(uint32_t *cpu) {
+    uint32_t _lo, _hi, _aux;
+    asm volatile ("RDTSCP" : "=a" (_lo), "=d" (_hi), "=c" (_aux));
+    if (cpu) *cpu = _aux;
+    return ((uint64_t)_hi << 32) | _lo;
+}
+
+/*
+* Samples the TSC and CLOCK_MONOTONIC_RAW at (nearly) the same instant.
+* The clock read is bracketed by two TSC reads, and the tightest of a
+* few attempts is kept so a preemption cannot skew the pair.
+*/
+static inline void _bench_tsc_pair(uint64_t *tsc, uint64_t *ns) {
+    uint64_t _best = UINT64_MAX;
+    for (int _i = 0; _i < 16; _i++) {
+        uint64_t _t0 = _bench_rdtscp(NULL);
+        uint64_t _n = _bench_clock_ns();
+        uint64_t _t1 = _bench_rdtscp(NULL);
+        if (_t1 - _t0 < _best) {
+            _best = _t1 - _t0;
+            *tsc = _t0 + (_t1 - _t0) / 2;
+            *ns = _n;
+        }
+    }
+}
+
+/*
+* Measures the invariant TSC frequency against CLOCK_MONOTONIC_RAW.
+* Runs three windows of BENCH_TSC_CALIBRATION_MS and keeps the median,
+* caches the result process-wide and returns nanoseconds per tick.
+*/
+static inline double bench_tsc_calibrate(void) {
+    double _r[3];
+    for (int _k = 0; _k < 3; _k++) {
+        uint64_t _tsc0 = 0, _ns0 = 0, _tsc1 = 0, _ns1 = 0;
+        _bench_tsc_pair(&_tsc0, &_ns0);
+        while (_bench_clock_ns() - _ns0 < BENCH_TSC_CALIBRATION_MS * 1000000ULL)
+            ;
+        _bench_tsc_pair(&_tsc1, &_ns1);
+        _r[_k] = (double)(_ns1 - _ns0) / (double)(_tsc1 - _tsc0);
+    }
+    /* Median of three */
+    double _lo = _r[0] < _r[1] ? _r[0] : _r[1];
+    double _hi = _r[0] < _r[1] ? _r[1] : _r[0];
+    _bench_tsc_ns_per_cycle = _r[2] < _lo ? _lo : (_r[2] > _hi ? _hi : _r[2]);
+    return _bench_tsc_ns_per_cycle;
+}
+
+/* Nanoseconds per TSC tick, calibrating on first use */
+static inline double bench_tsc_ns_per_cycle(void) {
+    if (_bench_tsc_ns_per_cycle == 0.0)
+        bench_tsc_calibrate();
+    return _bench_tsc_ns_per_cycle;
+}
+
+/* Converts a TSC tick count to nanoseconds */
+static inline double bench_tsc_to_ns(double cycles) {
+    return cycles * bench_tsc_ns_per_cycle();
+}
+
+/* Timer sources a benchmark can be measured with */
+#define BENCH_TIMER_CLOCK 0 /* CLOCK_MONOTONIC_RAW, nanoseconds */
+#define BENCH_TIMER_TSC   1 /* RDTSCP, reference cycles */
+#define BENCH_TIMER_PMC   2 /* RDPMC, core cycles (see BENCH_RDPMC) */
+#define BENCH_TIMER_COUNT 3
+
+/* Unit of raw values measured with a timer, as used in structured output */
+static inline const char *bench_timer_unit(int timer) {
+    return timer == BENCH_TIMER_CLOCK ? "ns" : timer == BENCH_TIMER_TSC ? "cycles" : "core_cycles";
+}
+
+/* Number of empty-block samples used to measure the timer floor */
+#ifndef BENCH_FLOOR_SAMPLES
+#define BENCH_FLOOR_SAMPLES 10000
+#endif
+
+/*
+* Batched mode: a sample must last at least this many timer floors,
+* so the timer reads become a small fraction of each sample.
+*/
+#ifndef BENCH_BATCH_FLOOR_FACTOR
+#define BENCH_BATCH_FLOOR_FACTOR 100
+#endif
+
+/* Upper bound for the automatically chosen batch size */
+#ifndef BENCH_BATCH_MAX
+#define BENCH_BATCH_MAX (1ULL << 30)
+#endif
+
+/* Pass as iterations to pick the count automatically (see BENCH_AUTO) */
+#define BENCH_AUTO_ITERATIONS 0
+
+/*
+* Automatic mode never stops on the error target below this many samples
+* or before this fraction of the budget is spent: timers tick in whole
+* ns or cycles, so a few samples of a short block are often identical
+* and their RSE says nothing about the run-to-run noise.
+*/
+#ifndef BENCH_AUTO_MIN_RUNS
+#define BENCH_AUTO_MIN_RUNS 1000
+#endif
+
+#ifndef BENCH_AUTO_MIN_BUDGET
+#define BENCH_AUTO_MIN_BUDGET 0.1
+#endif
+
+/* Largest warmup window (bench_config.warmup_window is clamped to it) */
+#ifndef BENCH_WARMUP_WINDOW_MAX
+#define BENCH_WARMUP_WINDOW_MAX 256
+#endif
+
+/*
+* Warmup policies. Warmup runs the block an unknown number of extra
+* times, so runs with a fixed iteration count, which may count on
+* exactly that many executions, only get it when asked for.
+*/
+#define BENCH_WARMUP_OFF  0
+#define BENCH_WARMUP_ON   1 /* every run */
+#define BENCH_WARMUP_AUTO 2 /* automatic mode (BENCH_AUTO_ITERATIONS) only */
+
+/* Outlier classification methods for recorded samples */
+#define BENCH_OUTLIERS_TUKEY 0 /* fences at 1.5 (mild) and 3 (severe) IQR beyond the quartiles */
+#define BENCH_OUTLIERS_MAD   1 /* fences at 3 (mild) and 6 (severe) robust sigmas (1.4826 MAD) from the median */
+
+struct bench_reporter;
+
+/*
+* Runtime options shared by every benchmark in the process.
+* Set fields directly before running benchmarks, e.g.
+*     bench_config.subtract_overhead = 1;
+*/
+struct bench_config {
+    int subtract_overhead; /* subtract the median timer floor from every statistic */
+    double budget_ms;      /* automatic mode: wall-time budget per benchmark */
+    double target_rse;     /* automatic mode: stop once stderr / mean is below this */
+    int warmup;            /* BENCH_WARMUP_*: run the block until timings stabilize before recording */
+    int warmup_window;     /* samples per warmup window */
+    double warmup_tolerance; /* stable once window medians differ by less than this (0.02 = 2%) */
+    double warmup_max_ms;  /* give up on stabilizing after this long */
+    int record;            /* keep every sample for percentiles, stddev and MAD */
+    int histogram;         /* log-linear histogram: percentiles in constant memory, ASCII plot */
+    int outlier_method;    /* BENCH_OUTLIERS_*, applied to recorded samples */
+    int drop_outliers;     /* also report statistics with outliers removed */
+    const struct bench_reporter *reporter; /* output format, NULL for text */
+    const char *output;    /* output file path, NULL for stdout */
+    const char *baseline_save; /* write every result's samples to this baseline file */
+    const char *baseline;  /* compare every result against this baseline file */
+    double regression_threshold; /* slowdown of the median counted as a regression (0.05 = 5%) */
+    double significance;   /* p-value below which a difference is significant */
+    int pin_cpu;           /* pin the benchmarking thread to this CPU, -1 to leave it to the scheduler */
+    int fifo;              /* SCHED_FIFO priority for the benchmarking thread, 0 to keep the policy */
+    int check_environment; /* warn on stderr about noisy host settings before the first run */
+};
+
+_BENCH_SHARED struct bench_config bench_config = {
+    0,      /* subtract_overhead */
+    1000.0, /* budget_ms */
+    0.01,   /* target_rse */
+    BENCH_WARMUP_AUTO, /* warmup */
+    32,     /* warmup_window */
+    0.02,   /* warmup_tolerance */
+    200.0,  /* warmup_max_ms */
+    0,      /* record */
+    0,      /* histogram */
+    BENCH_OUTLIERS_TUKEY, /* outlier_method */
+    0,      /* drop_outliers */
+    NULL,   /* reporter */
+    NULL,   /* output */
+    NULL,   /* baseline_save */
+    NULL,   /* baseline */
+    0.05,   /* regression_threshold */
+    0.01,   /* significance */
+    -1,     /* pin_cpu */
+    0,      /* fifo */
+    1,      /* check_environment */
+};
+
+/*
+* Timer floor: what an empty { } block measures with a given timer.
+* This is the cost of the timer reads and barriers themselves and the
+* resolution limit of every result reported with that timer.
+*/
+struct bench_floor {
+    double min;    /* fastest empty sample, in timer units */
+    double median; /* typical empty sample, in timer units */
+    int ready;
+};
+
+_BENCH_SHARED struct bench_floor _bench_floors[BENCH_TIMER_COUNT];
+
+/*
+* Processor IDs (RDTSCP's ECX) at the start and stop stamps of the last
+* TSC sample of this thread. TSCs of different cores are not guaranteed
+* to agree, and a migration also costs the block its warm caches, so
+* samples that started and stopped on different CPUs are discarded.
+*/
+_BENCH_SHARED __thread uint32_t _bench_tsc_cpu[2];
+
+static inline int _bench_stamp_migrated(int timer) {
+    return timer == BENCH_TIMER_TSC && _bench_tsc_cpu[0] != _bench_tsc_cpu[1];
+}
+
+/*
+* Timestamps taken around the measured block. The barriers keep the
+* compiler from moving the block's memory accesses across the reads.
+* The run state is passed in for timers that record more than a time.
+*/
+#define _BENCH_START_CLOCK(r, t) do { \
+    bench_clobber_memory(); \
+    (t) = _bench_clock_ns(); \
+} while (0)
+#define _BENCH_STOP_CLOCK(r, t) do { \
+    bench_clobber_memory(); \
+    (t) = _bench_clock_ns(); \
+} while (0)
+#define _BENCH_START_TSC(r, t) do { \
+    (t) = _bench_rdtscp(&_bench_tsc_cpu[0]); \
+    bench_clobber_memory(); \
+} while (0)
+#define _BENCH_STOP_TSC(r, t) do { \
+    bench_clobber_memory(); \
+    (t) = _bench_rdtscp(&_bench_tsc_cpu[1]); \
+} while (0)
+
+/*
+* Core cycles and retired instructions read from user space with RDPMC.
+* Both counters are perf_event counters of this thread with their
+* control page mmap'd; the kernel publishes which hardware counter backs
+* each event and an offset to add, guarded by a sequence lock. The
+* counters are opened once per process (single-threaded use) and stay
+* open, so the timer floor and every RDPMC run read the same counters.
+*/
+struct bench_pmc {
+    int fd[2];                              /* cycles, instructions */
+    struct perf_event_mmap_page *page[2];
+    int ready;                              /* 1 usable, -1 unavailable, 0 not tried */
+    int error;                              /* errno, or 0 when the page forbids rdpmc */
+    uint64_t ins[2];                        /* instructions at the last start/stop stamp */
+    uint64_t ins_floor;                     /* instructions retired by an empty stamp pair */
+};
+
+_BENCH_SHARED struct bench_pmc _bench_pmc = { { -1, -1 }, { NULL, NULL }, 0, 0, { 0, 0 }, 0 };
+
+static inline uint64_t _bench_rdpmc(uint32_t counter) {
+    uint32_t _lo, _hi;
+    asm volatile ("lfence\n\trdpmc" : "=a" (_lo), "=d" (_hi) : "c" (counter));
+    return ((uint64_t)_hi << 32) | _lo;
+}
+
+/*
+* Reads a counter through its mmap page: retry while the kernel updates
+* the page (odd or changed lock), sign-extend the pmc_width-bit hardware
+* value and add the kernel's offset.
+*/
+static inline uint64_t _bench_pmc_read(const volatile struct perf_event_mmap_page *pc) {
+    uint32_t _seq, _idx;
+    uint64_t _count;
+    do {
+        _seq = pc->lock;
+        bench_clobber_memory();
+        _idx = pc->index;
+        _count = (uint64_t)pc->offset;
+        if (pc->cap_user_rdpmc && _idx) {
+            unsigned _shift = 64 - pc->pmc_width;
+            int64_t _pmc = (int64_t)(_bench_rdpmc(_idx - 1) << _shift) >> _shift;
+            _count += (uint64_t)_pmc;
+        }
+        bench_clobber_memory();
+    } while (pc->lock != _seq);
+    return _count;
+}
+
+/*
+* PMC timestamps: cycles sit innermost, next to the block. When RDPMC is
+* unavailable runs fall back to BENCH_TIMER_TSC before the loop starts, so
+* these are only reached with open counters.
+*/
+#define _BENCH_START_PMC(r, t) do { \
+    _bench_pmc.ins[0] = _bench_pmc_read(_bench_pmc.page[1]); \
+    (t) = _bench_pmc_read(_bench_pmc.page[0]); \
+    bench_clobber_memory(); \
+} while (0)
+#define _BENCH_STOP_PMC(r, t) do { \
+    bench_clobber_memory(); \
+    (t) = _bench_pmc_read(_bench_pmc.page[0]); \
+    _bench_pmc.ins[1] = _bench_pmc_read(_bench_pmc.page[1]); \
+} while (0)
+
+static inline int _bench_pmc_open_one(int i, uint64_t config) {
+    struct perf_event_attr _a;
+    memset(&_a, 0, sizeof(_a));
+    _a.size = sizeof(_a);
+    _a.type = PERF_TYPE_HARDWARE;
+    _a.config = config;
+    _a.pinned = 1;
+    _a.exclude_kernel = 1;
+    _a.exclude_hv = 1;
+    _bench_pmc.fd[i] = (int)syscall(SYS_perf_event_open, &_a, 0, -1, -1, 0);
+    if (_bench_pmc.fd[i] < 0) {
+        _bench_pmc.error = errno;
+        return 0;
+    }
+    void *_p = mmap(NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, _bench_pmc.fd[i], 0);
+    if (_p == MAP_FAILED) {
+        _bench_pmc.error = errno;
+        return 0;
+    }
+    _bench_pmc.page[i] = (struct perf_event_mmap_page *)_p;
+    /* cap_user_rdpmc is only meaningful once the event is scheduled */
+    return _bench_pmc.page[i]->cap_user_rdpmc && _bench_pmc.page[i]->index;
+}
+
+/* Unmaps and closes whatever counters were opened, so a failed open leaves no pinned events behind */
+static inline void _bench_pmc_close(void) {
+    for (int _i = 0; _i < 2; _i++) {
+        if (_bench_pmc.page[_i])
+            munmap(_bench_pmc.page[_i], (size_t)sysconf(_SC_PAGESIZE));
+        if (_bench_pmc.fd[_i] >= 0)
+            close(_bench_pmc.fd[_i]);
+        _bench_pmc.page[_i] = NULL;
+        _bench_pmc.fd[_i] = -1;
+    }
+}
+
+/* Opens the RDPMC counters once; nonzero when they can be read from user space */
+static inline int bench_pmc_open(void) {
+    if (_bench_pmc.ready)
+        return _bench_pmc.ready > 0;
+    _bench_pmc.ready = -1;
+    if (!_bench_pmc_open_one(0, PERF_COUNT_HW_CPU_CYCLES) ||
+        !_bench_pmc_open_one(1, PERF_COUNT_HW_INSTRUCTIONS)) {
+        _bench_pmc_close();
+        return 0;
+    }
+    _bench_pmc.ready = 1;
+
+    /* Instructions retired by the stamps themselves; deterministic, so the minimum */
+    _bench_pmc.ins_floor = UINT64_MAX;
+    for (int _i = 0; _i < 1000; _i++) {
+        uint64_t _t0, _t1;
+        _BENCH_START_PMC(NULL, _t0);
+        _BENCH_STOP_PMC(NULL, _t1);
+        (void)_t0;
+        (void)_t1;
+        uint64_t _d = _bench_pmc.ins[1] - _bench_pmc.ins[0];
+        _bench_pmc.ins_floor = _d < _bench_pmc.ins_floor ? _d : _bench_pmc.ins_floor;
+    }
+    return 1;
+}
+
+/* Why RDPMC is unavailable, for reports */
+static inline const char *bench_pmc_error(void) {
+    return _bench_pmc.error ? strerror(_bench_pmc.error) : "user-space rdpmc not permitted";
+}
+
+static inline int _bench_cmp_u64(const void *a, const void *b) {
+    uint64_t _x = *(const uint64_t *)a, _y = *(const uint64_t *)b;
+    return _x < _y ? -1 : _x > _y;
+}
+
+/* Times BENCH_FLOOR_SAMPLES empty blocks exactly like a real sample */
+#define _BENCH_FLOOR_LOOP(TIMER, samples) do { \
+    for (int _bench_i = 0; _bench_i < BENCH_FLOOR_SAMPLES; _bench_i++) { \
+        uint64_t _bench_t0, _bench_t1; \
+        _BENCH_START_##TIMER(NULL, _bench_t0); \
+        { } \
+        _BENCH_STOP_##TIMER(NULL, _bench_t1); \
+        (samples)[_bench_i] = _bench_t1 - _bench_t0; \
+    } \
+} while (0)
+
+/* Measures the floor of a timer once and caches it process-wide */
+static inline const struct bench_floor *bench_timer_floor(int timer) {
+    struct bench_floor *_f = &_bench_floors[timer];
+    if (_f->ready)
+        return _f;
+
+    uint64_t *_s = (uint64_t *)malloc(BENCH_FLOOR_SAMPLES * sizeof(uint64_t));
+    if (!_s)
+        return _f;
+    if (timer == BENCH_TIMER_PMC)
+        _BENCH_FLOOR_LOOP(PMC, _s);
+    else if (timer == BENCH_TIMER_TSC)
+        _BENCH_FLOOR_LOOP(TSC, _s);
+    else
+        _BENCH_FLOOR_LOOP(CLOCK, _s);
+    qsort(_s, BENCH_FLOOR_SAMPLES, sizeof(uint64_t), _bench_cmp_u64);
+    _f->min = (double)_s[0];
+    _f->median = (double)_s[BENCH_FLOOR_SAMPLES / 2];
+    _f->ready = 1;
+    free(_s);
+    return _f;
+}
+
+/*
+* Log-linear latency histogram (HdrHistogram-style layout).
+* Values below 2^BENCH_HIST_BITS get a bucket each; above that, every
+* power of two is split into 2^(BENCH_HIST_BITS-1) equal sub-buckets.
+* A bucket is at most 1/2^(BENCH_HIST_BITS-1) of its lower bound wide,
+* so reporting its midpoint is within 1/2^BENCH_HIST_BITS (~3%) of any
+* sample in it. The whole uint64_t range takes 976 buckets (~8 KB).
+*/
+#ifndef BENCH_HIST_BITS
+#define BENCH_HIST_BITS 5
+#endif
+#define BENCH_HIST_LINEAR (1ULL << BENCH_HIST_BITS)
+#define BENCH_HIST_HALF   (BENCH_HIST_LINEAR / 2)
+#define BENCH_HIST_BUCKETS (BENCH_HIST_LINEAR + (64 - BENCH_HIST_BITS) * BENCH_HIST_HALF)
+
+/* Rows of the ASCII distribution plot */
+#ifndef BENCH_HIST_ROWS
+#define BENCH_HIST_ROWS 20
+#endif
+
+struct bench_hist {
+    uint64_t count;
+    uint64_t buckets[BENCH_HIST_BUCKETS];
+};
+
+/* Bucket index of a value; O(1), a single bit scan */
+static inline unsigned _bench_hist_index(uint64_t v) {
+    if (v < BENCH_HIST_LINEAR)
+        return (unsigned)v;
+    unsigned _shift = (unsigned)(63 - __builtin_clzll(v)) - (BENCH_HIST_BITS - 1);
+    return (unsigned)(BENCH_HIST_LINEAR + (_shift - 1) * BENCH_HIST_HALF +
+                      ((v >> _shift) - BENCH_HIST_HALF));
+}
+
+/* Smallest value falling into bucket i */
+static inline uint64_t bench_hist_lower(unsigned i) {
+    if (i < BENCH_HIST_LINEAR)
+        return i;
+    unsigned _shift = (unsigned)((i - BENCH_HIST_LINEAR) / BENCH_HIST_HALF) + 1;
+    return (((i - BENCH_HIST_LINEAR) % BENCH_HIST_HALF) + BENCH_HIST_HALF) << _shift;
+}
+
+/* Width of bucket i */
+static inline uint64_t bench_hist_width(unsigned i) {
+    return i < BENCH_HIST_LINEAR ? 1 : 1ULL << ((i - BENCH_HIST_LINEAR) / BENCH_HIST_HALF + 1);
+}
+
+static inline void bench_hist_add(struct bench_hist *h, uint64_t v) {
+    h->buckets[_bench_hist_index(v)]++;
+    h->count++;
+}
+
+static inline void bench_hist_merge(struct bench_hist *dst, const struct bench_hist *src) {
+    for (unsigned _i = 0; _i < BENCH_HIST_BUCKETS; _i++)
+        dst->buckets[_i] += src->buckets[_i];
+    dst->count += src->count;
+}
+
+/* Percentile q (0..100) as the midpoint of the bucket holding that rank */
+static inline double bench_hist_percentile(const struct bench_hist *h, double q) {
+    if (!h->count)
+        return 0;
+    uint64_t _rank = (uint64_t)(q / 100.0 * (double)(h->count - 1));
+    uint64_t _seen = 0;
+    for (unsigned _i = 0; _i < BENCH_HIST_BUCKETS; _i++) {
+        _seen += h->buckets[_i];
+        if (_seen > _rank)
+            return (double)bench_hist_lower(_i) + (double)(bench_hist_width(_i) - 1) / 2;
+    }
+    return 0;
+}
+
+/*
+* Hardware performance counters (Linux perf_event). Each event is opened
+* once per benchmark, disabled, counting user space of this thread only.
+* They are enabled when the measurement phase starts and disabled when it
+* ends, so a benchmark costs a few syscalls in total and none per sample.
+*/
+#define BENCH_PERF_EVENTS 6
+
+static const char *const bench_perf_names[BENCH_PERF_EVENTS] = {
+    "instructions", "cycles", "branch-misses", "l1d-misses", "llc-misses", "dtlb-misses",
+};
+
+struct bench_perf {
+    int fd[BENCH_PERF_EVENTS];   /* -1 when the event is not available */
+    double count[BENCH_PERF_EVENTS]; /* scaled counts of the last enable/disable span */
+    int error;                   /* errno of the first failed open */
+};
+
+static inline int _bench_perf_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr _a;
+    memset(&_a, 0, sizeof(_a));
+    _a.size = sizeof(_a);
+    _a.type = type;
+    _a.config = config;
+    _a.disabled = 1;
+    _a.exclude_kernel = 1;
+    _a.exclude_hv = 1;
+    _a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &_a, 0, -1, -1, 0);
+}
+
+#define _BENCH_PERF_CACHE(cache, op, result) \
+    ((cache) | ((PERF_COUNT_HW_CACHE_OP_##op) << 8) | ((PERF_COUNT_HW_CACHE_RESULT_##result) << 16))
+
+/* Opens every event that this host supports; returns the number opened */
+static inline int bench_perf_open(struct bench_perf *p) {
+    static const struct { uint32_t type; uint64_t config; } _ev[BENCH_PERF_EVENTS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, _BENCH_PERF_CACHE(PERF_COUNT_HW_CACHE_L1D, READ, MISS) },
+        { PERF_TYPE_HW_CACHE, _BENCH_PERF_CACHE(PERF_COUNT_HW_CACHE_LL, READ, MISS) },
+        { PERF_TYPE_HW_CACHE, _BENCH_PERF_CACHE(PERF_COUNT_HW_CACHE_DTLB, READ, MISS) },
+    };
+    int _opened = 0;
+    memset(p, 0, sizeof(*p));
+    for (int _i = 0; _i < BENCH_PERF_EVENTS; _i++) {
+        p->fd[_i] = _bench_perf_open(_ev[_i].type, _ev[_i].config);
+        if (p->fd[_i] >= 0)
+            _opened++;
+        else if (!p->error)
+            p->error = errno;
+    }
+    return _opened;
+}
+
+static inline void bench_perf_enable(struct bench_perf *p) {
+    for (int _i = 0; _i < BENCH_PERF_EVENTS; _i++) {
+        if (p->fd[_i] >= 0) {
+            ioctl(p->fd[_i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(p->fd[_i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/* Stops counting and reads the counts, scaled up if the kernel multiplexed them */
+static inline void bench_perf_disable(struct bench_perf *p) {
+    for (int _i = 0; _i < BENCH_PERF_EVENTS; _i++)
+        if (p->fd[_i] >= 0)
+            ioctl(p->fd[_i], PERF_EVENT_IOC_DISABLE, 0);
+    for (int _i = 0; _i < BENCH_PERF_EVENTS; _i++) {
+        uint64_t _v[3]; /* value, time enabled, time running */
+        p->count[_i] = -1;
+        if (p->fd[_i] < 0 || read(p->fd[_i], _v, sizeof(_v)) != (ssize_t)sizeof(_v) || !_v[2])
+            continue;
+        p->count[_i] = (double)_v[0] * ((double)_v[1] / (double)_v[2]);
+    }
+}
+
+static inline void bench_perf_close(struct bench_perf *p) {
+    for (int _i = 0; _i < BENCH_PERF_EVENTS; _i++) {
+        if (p->fd[_i] >= 0)
+            close(p->fd[_i]);
+        p->fd[_i] = -1;
+    }
+}
+
+/* Summary of one benchmark; raw values are in timer units */
+struct bench_result {
+    const char *name;
+    int timer;          /* BENCH_TIMER_* */
+    uint64_t runs;      /* recorded samples */
+    uint64_t batch;     /* block executions per sample; statistics are per execution */
+    uint64_t instructions; /* BENCH_TIMER_PMC: instructions retired by the block, summed */
+    const char *timer_note; /* why the requested timer was replaced, or NULL */
+    int threads;        /* threads that contributed samples (multi-threaded runs) */
+    double elapsed_ns;  /* wall time of the measurement phase, 0 if not tracked */
+    double speedup;     /* throughput relative to one thread (scaling sweeps), 0 if none */
+    double bytes;       /* bytes processed per execution of the block, 0 if not declared */
+    double items;       /* items processed per execution of the block, 0 if not declared */
+    double cold_ratio;  /* cold-cache mean / hot-cache mean (BENCH_COLD cold pass), 0 otherwise */
+    uint64_t migrated;  /* TSC samples discarded because the thread changed CPU */
+    int pinned_cpu;     /* CPU the run was pinned to, -1 if not pinned */
+    int fifo;           /* SCHED_FIFO priority of the run, 0 if not real-time */
+    uint64_t warmup;    /* samples discarded before timings stabilized */
+    int warmup_stable;  /* 0 when warmup hit bench_config.warmup_max_ms first */
+    uint64_t min, max, total;
+    double mean, m2;    /* running mean and sum of squared deviations (Welford) */
+    struct bench_floor floor;
+    double offset;      /* subtracted from each statistic (timer floor or 0) */
+    uint64_t *samples;  /* raw samples when recording, sorted once the run ends */
+    uint64_t nsamples;
+    double mad;         /* median absolute deviation of the raw samples */
+    struct bench_hist *hist; /* raw samples by bucket when bench_config.histogram is set */
+    uint64_t outliers_low_severe, outliers_low_mild;
+    uint64_t outliers_high_mild, outliers_high_severe;
+    struct {
+        uint64_t runs;
+        uint64_t min, max;
+        double mean, stddev; /* raw units */
+    } kept;             /* recorded samples left once outliers are removed */
+    struct {
+        int found;      /* a baseline entry with this name was compared */
+        double ratio;   /* 1 + Hodges-Lehmann shift (now - baseline) / median in baseline */
+        double p;       /* two-sided Mann-Whitney U p-value */
+        int verdict;    /* -1 significantly faster, 0 no change, 1 significantly slower */
+        int regression; /* slower beyond bench_config.regression_threshold */
+    } baseline;
+    struct {
+        const char *versus; /* name of the other block of an A/B run, NULL otherwise */
+        uint64_t pairs;     /* rounds in which both blocks produced a sample */
+        double ratio;       /* geometric mean of this / other over the pairs */
+        double lo, hi;      /* 95% confidence interval of the ratio */
+    } ab;
+    struct {
+        int enabled;        /* counters were requested for this benchmark */
+        int error;          /* errno when no counter could be opened */
+        double per_iteration[BENCH_PERF_EVENTS]; /* harness subtracted; -1 if unavailable */
+    } perf;
+};
+
+/*
+* Spin barrier for releasing benchmark threads together. Spinning keeps
+* the wake-up latency far below a futex wake; waiters yield now and then
+* so oversubscribed runs still make progress.
+*/
+struct bench_barrier {
+    unsigned count;
+    unsigned arrived;
+    unsigned generation;
+};
+
+static inline void bench_barrier_wait(struct bench_barrier *b) {
+    unsigned _gen = __atomic_load_n(&b->generation, __ATOMIC_ACQUIRE);
+    if (__atomic_add_fetch(&b->arrived, 1, __ATOMIC_ACQ_REL) == b->count) {
+        __atomic_store_n(&b->arrived, 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&b->generation, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    for (unsigned _spins = 1; __atomic_load_n(&b->generation, __ATOMIC_ACQUIRE) == _gen; _spins++) {
+        asm volatile ("pause");
+        if (_spins % 4096 == 0)
+            sched_yield();
+    }
+}
+
+/* CPUs this process may run on, at most max of them; returns the count */
+static inline int bench_allowed_cpus(int *cpus, int max) {
+    unsigned long _mask[16] = { 0 };
+    long _bytes = syscall(SYS_sched_getaffinity, 0, sizeof(_mask), _mask);
+    int _n = 0;
+    for (int _c = 0; _c < _bytes * 8 && _n < max; _c++)
+        if (_mask[_c / (8 * sizeof(long))] & (1UL << (_c % (8 * sizeof(long)))))
+            cpus[_n++] = _c;
+    return _n;
+}
+
+/* Pins the calling thread to one CPU; 0 on success, errno otherwise */
+static inline int bench_pin_cpu(int cpu) {
+    unsigned long _mask[16] = { 0 };
+    if (cpu < 0 || cpu >= (int)(sizeof(_mask) * 8))
+        return EINVAL;
+    _mask[cpu / (8 * sizeof(long))] = 1UL << (cpu % (8 * sizeof(long)));
+    return syscall(SYS_sched_setaffinity, 0, sizeof(_mask), _mask) == 0 ? 0 : errno;
+}
+
+/*
+* Pinning and real-time scheduling of the benchmarking thread, from
+* bench_config.pin_cpu and bench_config.fifo. Applied before a run
+* whenever the settings changed; the CPUs allowed before pinning are
+* kept for multi-threaded runs to spread their threads over.
+*/
+struct bench_sched {
+    int applied;
+    int pin_cpu, fifo;    /* settings last applied */
+    int pinned, fifo_active; /* what took effect: CPU or -1, priority or 0 */
+    int ncpus;
+    int cpus[1024];       /* CPUs allowed at the first application */
+};
+
+_BENCH_SHARED struct bench_sched _bench_sched;
+
+static inline void _bench_sched_apply(void) {
+    struct bench_sched *_s = &_bench_sched;
+    if (!_s->applied) {
+        _s->ncpus = bench_allowed_cpus(_s->cpus, 1024);
+        _s->pin_cpu = _s->pinned = -1;
+        _s->fifo = _s->fifo_active = 0;
+        _s->applied = 1;
+    }
+    if (bench_config.pin_cpu != _s->pin_cpu) {
+        int _err = bench_config.pin_cpu >= 0 ? bench_pin_cpu(bench_config.pin_cpu) : 0;
+        if (bench_config.pin_cpu < 0) {
+            /* Back to every CPU allowed originally */
+            unsigned long _mask[16] = { 0 };
+            for (int _i = 0; _i < _s->ncpus; _i++)
+                _mask[_s->cpus[_i] / (8 * sizeof(long))] |= 1UL << (_s->cpus[_i] % (8 * sizeof(long)));
+            syscall(SYS_sched_setaffinity, 0, sizeof(_mask), _mask);
+        }
+        if (_err)
+            fprintf(stderr, "bench: cannot pin to CPU %d: %s\n", bench_config.pin_cpu, strerror(_err));
+        _s->pin_cpu = bench_config.pin_cpu;
+        _s->pinned = _err ? -1 : bench_config.pin_cpu;
+    }
+    if (bench_config.fifo != _s->fifo) {
+        struct sched_param _p;
+        memset(&_p, 0, sizeof(_p));
+        _p.sched_priority = bench_config.fifo;
+        if (sched_setscheduler(0, bench_config.fifo > 0 ? SCHED_FIFO : SCHED_OTHER, &_p) == 0)
+            _s->fifo_active = bench_config.fifo > 0 ? bench_config.fifo : 0;
+        else
+            fprintf(stderr, "bench: cannot set SCHED_FIFO priority %d: %s\n", bench_config.fifo, strerror(errno));
+        _s->fifo = bench_config.fifo;
+    }
+}
+
+/* Phases of a run, in order */
+#define _BENCH_PHASE_BATCH   0 /* growing the batch size until samples clear the floor */
+#define _BENCH_PHASE_WARMUP  1 /* discarding samples until window medians settle */
+#define _BENCH_PHASE_MEASURE 2 /* recording samples */
+#define _BENCH_PHASE_DONE    3
+
+/* Loop state of a running benchmark */
+struct bench_run {
+    struct bench_result res;
+    uint64_t iterations;
+    int phase;               /* _BENCH_PHASE_* */
+    uint64_t batch_target;   /* shortest acceptable sample while sizing the batch */
+    uint64_t batch_best;     /* fastest sample seen at the current batch size */
+    int batch_tries;
+    uint64_t auto_budget_ns; /* automatic mode when nonzero */
+    double auto_rse;
+    uint64_t auto_start_ns;
+    uint64_t auto_next_check; /* sample count at which the stop rule is evaluated next */
+    uint64_t warmup_deadline_ns;
+    double warmup_median;     /* median of the previous window, 0 before the first */
+    int warmup_n;             /* samples in the current window */
+    uint64_t warmup_samples[BENCH_WARMUP_WINDOW_MAX];
+    uint64_t samples_cap;
+    struct bench_perf *perf; /* counters enabled for the measurement phase, or NULL */
+    struct bench_barrier *barrier; /* waited on before measuring (multi-threaded runs) */
+};
+
+/* Converts a raw statistic to the reported value in timer units */
+static inline double bench_result_value(const struct bench_result *r, double raw) {
+    double _v = raw - r->offset;
+    return _v > 0 ? _v / (double)r->batch : 0;
+}
+
+/* Converts a reported value in timer units to nanoseconds */
+static inline double bench_result_ns(const struct bench_result *r, double v) {
+    return r->timer == BENCH_TIMER_TSC ? bench_tsc_to_ns(v) : r->timer == BENCH_TIMER_PMC ? NAN : v;
+}
+
+static inline double bench_result_avg(const struct bench_result *r) {
+    return r->runs ? bench_result_value(r, (double)r->total / r->runs) : 0;
+}
+
+/* Sample standard deviation of the raw samples, in timer units */
+static inline double bench_result_stddev_raw(const struct bench_result *r) {
+    return r->runs > 1 ? sqrt(r->m2 / (double)(r->runs - 1)) : 0;
+}
+
+/* Standard error of the mean of the raw samples, in timer units */
+static inline double bench_result_stderr_raw(const struct bench_result *r) {
+    return r->runs > 1 ? bench_result_stddev_raw(r) / sqrt((double)r->runs) : 0;
+}
+
+/*
+* Two-sided 95% quantile of Student's t distribution with df degrees of
+* freedom: tabulated up to 30, Cornish-Fisher expansion around the normal
+* quantile beyond (error below 1e-4).
+*/
+static inline double bench_t95(uint64_t df) {
+    static const double _table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if (df == 0)
+        return INFINITY;
+    if (df <= 30)
+        return _table[df - 1];
+    double _z = 1.959964, _n = (double)df;
+    double _z3 = _z * _z * _z, _z5 = _z3 * _z * _z;
+    return _z + (_z3 + _z) / (4 * _n) + (5 * _z5 + 16 * _z3 + 3 * _z) / (96 * _n * _n);
+}
+
+/* Relative standard error of the mean (stderr / mean) */
+static inline double bench_result_rse(const struct bench_result *r) {
+    if (r->runs < 2 || r->mean <= 0)
+        return INFINITY;
+    return bench_result_stderr_raw(r) / r->mean;
+}
+
+/* Converts a raw spread (stddev, MAD) to the reported scale in timer units */
+static inline double bench_result_scale(const struct bench_result *r, double raw) {
+    return raw / (double)r->batch;
+}
+
+/* Half-width of the 95% confidence interval of the reported mean, in timer units */
+static inline double bench_result_ci95(const struct bench_result *r) {
+    return r->runs > 1 ? bench_t95(r->runs - 1) * bench_result_scale(r, bench_result_stderr_raw(r)) : 0;
+}
+
+/*
+* Percentile q (0..100) of the raw samples, interpolating linearly
+* between closest ranks. Without recorded samples it comes from the
+* histogram (clamped to min/max); with neither it is 0.
+*/
+static inline double bench_result_percentile_raw(const struct bench_result *r, double q) {
+    if (!r->nsamples) {
+        if (!r->hist || !r->hist->count)
+            return 0;
+        double _v = bench_hist_percentile(r->hist, q);
+        _v = _v < (double)r->min ? (double)r->min : _v;
+        return _v > (double)r->max ? (double)r->max : _v;
+    }
+    double _pos = q / 100.0 * (double)(r->nsamples - 1);
+    uint64_t _i = (uint64_t)_pos;
+    if (_i + 1 >= r->nsamples)
+        return (double)r->samples[r->nsamples - 1];
+    double _frac = _pos - (double)_i;
+    return (double)r->samples[_i] + _frac * ((double)r->samples[_i + 1] - (double)r->samples[_i]);
+}
+
+/* Reported percentile q (0..100), in timer units */
+static inline double bench_result_percentile(const struct bench_result *r, double q) {
+    return bench_result_value(r, bench_result_percentile_raw(r, q));
+}
+
+/* BENCH_TIMER_PMC: instructions retired per execution of the block */
+static inline double bench_result_instructions(const struct bench_result *r) {
+    if (!r->runs)
+        return 0;
+    double _v = (double)r->instructions / (double)r->runs - (double)_bench_pmc.ins_floor;
+    return _v > 0 ? _v / (double)r->batch : 0;
+}
+
+/* Block executions per second over the measurement phase (all threads), 0 if unknown */
+static inline double bench_result_ops_per_sec(const struct bench_result *r) {
+    return r->elapsed_ns > 0 ? (double)r->runs * (double)r->batch / r->elapsed_ns * 1e9 : 0;
+}
+
+/*
+* Work processed per second when one execution takes the reported value
+* v (timer units): work / time. Feeding it the mean or a latency
+* percentile gives the matching throughput; slower percentiles give
+* lower rates. 0 for BENCH_TIMER_PMC, whose cycles have no fixed duration.
+*/
+static inline double bench_result_rate(const struct bench_result *r, double work, double v) {
+    double _ns = bench_result_ns(r, v);
+    return work > 0 && _ns > 0 ? work / _ns * 1e9 : 0;
+}
+
+/* Total work per second over the wall time of a multi-threaded run, 0 if unknown */
+static inline double bench_result_total_rate(const struct bench_result *r, double work) {
+    return work * bench_result_ops_per_sec(r);
+}
+
+/* Total number of outliers among the recorded samples */
+static inline uint64_t bench_result_outliers(const struct bench_result *r) {
+    return r->outliers_low_severe + r->outliers_low_mild +
+           r->outliers_high_mild + r->outliers_high_severe;
+}
+
+/* Unit suffix of raw values for a result's timer */
+static inline const char *bench_result_unit(const struct bench_result *r) {
+    return r->timer == BENCH_TIMER_CLOCK ? "ns" : " cycles";
+}
+
+/* Prints one statistic line in the unit of the result's timer */
+static inline void _bench_print_value(FILE *out, const struct bench_result *r, const char *label,
+                                      double v) {
+    if (r->timer == BENCH_TIMER_TSC)
+        fprintf(out, "%-8s%7.2f cycles %10.2fns\n", label, v, bench_result_ns(r, v));
+    else if (r->timer == BENCH_TIMER_PMC)
+        fprintf(out, "%-8s%7.2f core cycles\n", label, v);
+    else
+        fprintf(out, "%-8s%7.2fns\n", label, v);
+}
+
+/*
+* ASCII plot of the histogram of a result. Buckets from the smallest
+* sample up to p99.9 are merged into at most BENCH_HIST_ROWS rows, so a
+* few huge outliers do not squash the body; the tail above p99.9 gets
+* one extra row. Bucket widths grow with the value, so rows are log-spaced.
+*/
+static inline void bench_hist_print(FILE *out, const struct bench_result *r) {
+    const struct bench_hist *_h = r->hist;
+    unsigned _first = BENCH_HIST_BUCKETS, _last = 0;
+    for (unsigned _i = 0; _i < BENCH_HIST_BUCKETS; _i++) {
+        if (_h->buckets[_i]) {
+            _first = _i < _first ? _i : _first;
+            _last = _i;
+        }
+    }
+    if (_first > _last)
+        return;
+    unsigned _tail = _last;
+    _last = _bench_hist_index((uint64_t)bench_hist_percentile(_h, 99.9));
+    _last = _last < _first ? _first : _last;
+
+    unsigned _span = _last - _first + 1;
+    unsigned _per_row = (_span + BENCH_HIST_ROWS - 1) / BENCH_HIST_ROWS;
+    uint64_t _rows[BENCH_HIST_ROWS] = { 0 }, _peak = 1;
+    for (unsigned _i = _first; _i <= _last; _i++)
+        _rows[(_i - _first) / _per_row] += _h->buckets[_i];
+    for (unsigned _k = 0; _k < BENCH_HIST_ROWS; _k++)
+        _peak = _rows[_k] > _peak ? _rows[_k] : _peak;
+
+    fprintf(out, "Histogram (%s)\n", bench_timer_unit(r->timer));
+    for (unsigned _k = 0; _k * _per_row < _span; _k++) {
+        unsigned _lo = _first + _k * _per_row;
+        unsigned _hi = _lo + _per_row - 1 > _last ? _last : _lo + _per_row - 1;
+        double _from = bench_result_value(r, (double)bench_hist_lower(_lo));
+        double _to = bench_result_value(r, (double)(bench_hist_lower(_hi) + bench_hist_width(_hi)));
+        int _bar = (int)(40 * _rows[_k] / _peak);
+        fprintf(out, "  %10.2f - %-10.2f |%-40.*s| %6.2f%%\n", _from, _to, _bar,
+                "########################################",
+                100.0 * (double)_rows[_k] / (double)_h->count);
+    }
+    if (_tail > _last) {
+        uint64_t _rest = 0;
+        for (unsigned _i = _last + 1; _i <= _tail; _i++)
+            _rest += _h->buckets[_i];
+        double _from = bench_result_value(r, (double)bench_hist_lower(_last + 1));
+        fprintf(out, "  %10.2f +            |%-40s| %6.2f%%\n", _from, "",
+                100.0 * (double)_rest / (double)_h->count);
+    }
+}
+
+/* Formats a rate with binary (KiB/s, MiB/s, ...) or decimal (k/s, M/s, ...) prefixes */
+static inline void _bench_format_rate(char *buf, size_t len, double v, int binary, const char *unit) {
+    static const char *const _iec[] = { "", "Ki", "Mi", "Gi", "Ti", "Pi" };
+    static const char *const _si[] = { "", "k", "M", "G", "T", "P" };
+    double _step = binary ? 1024 : 1000;
+    int _k = 0;
+    while (v >= _step && _k < 5) {
+        v /= _step;
+        _k++;
+    }
+    snprintf(buf, len, "%.2f %s%s/s", v, binary ? _iec[_k] : _si[_k], unit);
+}
+
+/* Prints one throughput line: mean, latency percentiles and the multi-threaded total */
+static inline void _bench_print_rate(FILE *out, const struct bench_result *r, const char *label,
+                                     double work, int binary, const char *unit) {
+    char _buf[32];
+    if (work <= 0 || r->timer == BENCH_TIMER_PMC || !r->runs)
+        return;
+    _bench_format_rate(_buf, sizeof(_buf), bench_result_rate(r, work, bench_result_avg(r)), binary, unit);
+    fprintf(out, "%-8s %s avg", label, _buf);
+    if (r->nsamples || r->hist) {
+        static const double _q[] = { 50, 90, 99, 99.9 };
+        static const char *const _qname[] = { "p50", "p90", "p99", "p99.9" };
+        for (int _i = 0; _i < 4; _i++) {
+            _bench_format_rate(_buf, sizeof(_buf), bench_result_rate(r, work, bench_result_percentile(r, _q[_i])),
+                               binary, unit);
+            fprintf(out, ", %s %s", _buf, _qname[_i]);
+        }
+    }
+    if (r->elapsed_ns > 0 && r->threads > 1) {
+        _bench_format_rate(_buf, sizeof(_buf), bench_result_total_rate(r, work), binary, unit);
+        fprintf(out, ", %s total", _buf);
+    }
+    fputc('\n', out);
+}
+
+/* Prints a result as a human-readable block */
+static inline void bench_report(FILE *out, const struct bench_result *r) {
+    fprintf(out, "[%s]\n", r->name);
+    _bench_print_value(out, r, "Avg", bench_result_avg(r));
+    if (r->runs > 1) {
+        _bench_print_value(out, r, "CI95 +-", bench_result_ci95(r));
+        _bench_print_value(out, r, "StdErr", bench_result_scale(r, bench_result_stderr_raw(r)));
+        _bench_print_value(out, r, "StdDev", bench_result_scale(r, bench_result_stddev_raw(r)));
+    }
+    _bench_print_value(out, r, "Min", r->runs ? bench_result_value(r, (double)r->min) : 0);
+    _bench_print_value(out, r, "Max", bench_result_value(r, (double)r->max));
+    if (r->nsamples || r->hist) {
+        _bench_print_value(out, r, "p50", bench_result_percentile(r, 50));
+        _bench_print_value(out, r, "p90", bench_result_percentile(r, 90));
+        _bench_print_value(out, r, "p99", bench_result_percentile(r, 99));
+        _bench_print_value(out, r, "p99.9", bench_result_percentile(r, 99.9));
+    }
+    if (r->nsamples) {
+        uint64_t _outliers = bench_result_outliers(r);
+        _bench_print_value(out, r, "MAD", bench_result_scale(r, r->mad));
+        fprintf(out, "Outliers %lu (%.2f%%): %lu low severe, %lu low mild, %lu high mild, %lu high severe\n",
+                _outliers, 100.0 * (double)_outliers / (double)r->nsamples,
+                r->outliers_low_severe, r->outliers_low_mild,
+                r->outliers_high_mild, r->outliers_high_severe);
+        if (bench_config.drop_outliers && r->kept.runs) {
+            _bench_print_value(out, r, "Avg*", bench_result_value(r, r->kept.mean));
+            _bench_print_value(out, r, "StdDev*", bench_result_scale(r, r->kept.stddev));
+            _bench_print_value(out, r, "Min*", bench_result_value(r, (double)r->kept.min));
+            _bench_print_value(out, r, "Max*", bench_result_value(r, (double)r->kept.max));
+            fprintf(out, "         * without outliers, %lu runs\n", r->kept.runs);
+        }
+    }
+    fprintf(out, "Runs     %lu\n", r->runs);
+    if (r->runs > 1)
+        fprintf(out, "RSE     %7.2f%%\n", bench_result_rse(r) * 100.0);
+    if (r->batch > 1)
+        fprintf(out, "Batch    %lu ops/sample\n", r->batch);
+    if (r->warmup)
+        fprintf(out, "Warmup   %lu samples%s\n", r->warmup, r->warmup_stable ? "" : " (not stable)");
+    if (r->timer == BENCH_TIMER_TSC)
+        fprintf(out, "TSC     %7.3f GHz\n", 1.0 / bench_tsc_ns_per_cycle());
+    if (r->timer == BENCH_TIMER_PMC && r->runs) {
+        double _cycles = bench_result_avg(r);
+        fprintf(out, "Instr   %7.2f per iteration\n", bench_result_instructions(r));
+        if (_cycles > 0)
+            fprintf(out, "IPC     %7.2f\n", bench_result_instructions(r) / _cycles);
+    }
+    if (r->timer_note)
+        fprintf(out, "Timer    %s\n", r->timer_note);
+    if (r->migrated)
+        fprintf(out, "Migrated %lu samples discarded (CPU changed between stamps)\n", r->migrated);
+    if ((r->pinned_cpu >= 0 && !r->threads) || r->fifo > 0) {
+        fprintf(out, "Sched   ");
+        if (r->pinned_cpu >= 0 && !r->threads)
+            fprintf(out, " CPU %d", r->pinned_cpu);
+        if (r->fifo > 0)
+            fprintf(out, " SCHED_FIFO %d", r->fifo);
+        fputc('\n', out);
+    }
+    if (r->threads)
+        fprintf(out, "Threads  %d, %.4g ops/s\n", r->threads, bench_result_ops_per_sec(r));
+    _bench_print_rate(out, r, "Bytes", r->bytes, 1, "B");
+    _bench_print_rate(out, r, "Items", r->items, 0, "");
+    if (r->cold_ratio > 0)
+        fprintf(out, "Cold    %7.2fx the hot-cache mean\n", r->cold_ratio);
+    if (r->speedup > 0)
+        fprintf(out, "Scaling  %.2fx speedup, %.0f%% efficiency\n", r->speedup,
+                100.0 * r->speedup / r->threads);
+    fprintf(out, "Floor   %7.2f%s min, %.2f%s median%s\n",
+            r->floor.min, bench_result_unit(r), r->floor.median, bench_result_unit(r),
+            r->offset > 0 ? " (subtracted)" : "");
+    if (r->perf.enabled) {
+        if (r->perf.error) {
+            fprintf(out, "Perf     unavailable: %s\n", strerror(r->perf.error));
+        } else {
+            fprintf(out, "Perf     per iteration\n");
+            for (int _i = 0; _i < BENCH_PERF_EVENTS; _i++) {
+                if (r->perf.per_iteration[_i] < 0)
+                    fprintf(out, "  %-14s n/a\n", bench_perf_names[_i]);
+                else
+                    fprintf(out, "  %-14s %10.2f\n", bench_perf_names[_i], r->perf.per_iteration[_i]);
+            }
+            if (r->perf.per_iteration[0] >= 0 && r->perf.per_iteration[1] > 0)
+                fprintf(out, "  %-14s %10.2f\n", "IPC", r->perf.per_iteration[0] / r->perf.per_iteration[1]);
+        }
+    }
+    if (r->ab.versus && r->ab.pairs > 1)
+        fprintf(out, "Ratio   %7.4fx vs [%s], 95%% CI [%.4f, %.4f], %lu pairs\n",
+                r->ab.ratio, r->ab.versus, r->ab.lo, r->ab.hi, r->ab.pairs);
+    if (r->baseline.found)
+        fprintf(out, "Baseline %+.2f%% %s (p=%.4f)%s\n", (r->baseline.ratio - 1) * 100,
+                r->baseline.p >= bench_config.significance ? "no significant change" :
+                r->baseline.verdict > 0 ? "slower" : r->baseline.verdict < 0 ? "faster" : "significant change",
+                r->baseline.p, r->baseline.regression ? " REGRESSION" : "");
+    if (r->hist)
+        bench_hist_print(out, r);
+    fprintf(out, "\n");
+}
+
+/*
+* Reporters turn finished results into output. A reporter is a table of
+* callbacks; bench_config.reporter selects one of the built-ins below or a
+* user-provided one, bench_config.output a file path (NULL for stdout).
+* The output is opened and begin() called on the first result; end() runs
+* from bench_output_close(), which is also registered with atexit().
+*/
+struct bench_reporter {
+    const char *name;
+    void (*begin)(FILE *out);
+    void (*result)(FILE *out, const struct bench_result *r);
+    void (*end)(FILE *out);
+};
+
+/*
+* Host the results were measured on: identity (fingerprint) and the
+* settings that make timings noisy. Tristate fields are -1 when unknown.
+*/
+struct bench_host {
+    char hostname[128];
+    char cpu[128];
+    char kernel[200];
+    char microcode[32];
+    char compiler[128];
+    char flags[512];     /* predefined macros describing the build, plus BENCH_CFLAGS */
+    char governor[32];   /* cpufreq governor of CPU 0 */
+    char isolated[128];  /* isolcpus list, empty when none */
+    int turbo;           /* frequency boost enabled */
+    int smt;             /* simultaneous multithreading active */
+    int aslr;            /* kernel.randomize_va_space, 0 = off */
+    int invariant_tsc;   /* CPUID 0x80000007 EDX bit 8: TSC rate independent of P/C-states */
+    double load[3];      /* load averages at startup */
+    int ready;
+};
+
+_BENCH_SHARED struct bench_host _bench_host_info;
+
+/* Name of the BENCH_CASE being run, NULL outside bench_main() */
+_BENCH_SHARED const char *_bench_current_case = NULL;
+
+/* First line of a /proc or /sys file without the newline; 0 if it cannot be read */
+static inline int _bench_read_line(const char *path, char *buf, size_t len) {
+    FILE *_f = fopen(path, "r");
+    if (!_f)
+        return 0;
+    int _ok = fgets(buf, (int)len, _f) != NULL;
+    fclose(_f);
+    if (_ok)
+        buf[strcspn(buf, "\n")] = 0;
+    return _ok;
+}
+
+/* Integer in a /proc or /sys file, -1 if it cannot be read */
+static inline int _bench_read_int(const char *path) {
+    char _buf[32];
+    return _bench_read_line(path, _buf, sizeof(_buf)) ? atoi(_buf) : -1;
+}
+
+static inline void _bench_cpuid(uint32_t leaf, uint32_t regs[4]) {
+    asm volatile ("cpuid" : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+                          : "a" (leaf), "c" (0));
+}
+
+/* Build description from the including translation unit's predefined macros */
+static inline void _bench_build_info(struct bench_host *h) {
+#if defined(__clang__)
+    snprintf(h->compiler, sizeof(h->compiler), "clang %s", __clang_version__);
+#elif defined(__GNUC__)
+    snprintf(h->compiler, sizeof(h->compiler), "gcc %s", __VERSION__);
+#else
+    snprintf(h->compiler, sizeof(h->compiler), "unknown");
+#endif
+#ifdef __cplusplus
+    snprintf(h->compiler + strlen(h->compiler), sizeof(h->compiler) - strlen(h->compiler),
+             " C++%ld", (long)__cplusplus);
+#endif
+    static const char *const _flags[] = {
+#ifdef __OPTIMIZE__
+        "__OPTIMIZE__",
+#endif
+#ifdef __OPTIMIZE_SIZE__
+        "__OPTIMIZE_SIZE__",
+#endif
+#ifdef __NO_INLINE__
+        "__NO_INLINE__",
+#endif
+#ifdef __FAST_MATH__
+        "__FAST_MATH__",
+#endif
+#ifdef NDEBUG
+        "NDEBUG",
+#endif
+#ifdef __PIC__
+        "__PIC__",
+#endif
+#ifdef __SSE4_2__
+        "__SSE4_2__",
+#endif
+#ifdef __AVX__
+        "__AVX__",
+#endif
+#ifdef __AVX2__
+        "__AVX2__",
+#endif
+#ifdef __FMA__
+        "__FMA__",
+#endif
+#ifdef __BMI2__
+        "__BMI2__",
+#endif
+#ifdef __AVX512F__
+        "__AVX512F__",
+#endif
+        NULL,
+    };
+    /* snprintf returns the untruncated length; clamp it so the next offset stays in the buffer */
+    size_t _len = 0;
+    for (int _i = 0; _flags[_i] && _len < sizeof(h->flags) - 1; _i++) {
+        _len += (size_t)snprintf(h->flags + _len, sizeof(h->flags) - _len, _len ? " %s" : "%s", _flags[_i]);
+        _len = _len < sizeof(h->flags) - 1 ? _len : sizeof(h->flags) - 1;
+    }
+#ifdef BENCH_CFLAGS
+    /* e.g. -DBENCH_CFLAGS="\"$(CFLAGS)\"" to record the exact command line */
+    if (_len < sizeof(h->flags) - 1)
+        snprintf(h->flags + _len, sizeof(h->flags) - _len, _len ? " cflags: %s" : "cflags: %s", BENCH_CFLAGS);
+#endif
+}
+
+static inline const struct bench_host *bench_host(void) {
+    struct bench_host *_h = &_bench_host_info;
+    if (_h->ready)
+        return _h;
+    if (gethostname(_h->hostname, sizeof(_h->hostname) - 1) != 0)
+        strcpy(_h->hostname, "unknown");
+    struct utsname _u;
+    if (uname(&_u) == 0)
+        snprintf(_h->kernel, sizeof(_h->kernel), "%s %s %s", _u.sysname, _u.release, _u.machine);
+    strcpy(_h->cpu, "unknown");
+    FILE *_f = fopen("/proc/cpuinfo", "r");
+    if (_f) {
+        char _line[256];
+        while (fgets(_line, sizeof(_line), _f)) {
+            char *_colon = strchr(_line, ':');
+            if (strncmp(_line, "model name", 10) == 0 && _colon) {
+                snprintf(_h->cpu, sizeof(_h->cpu), "%s", _colon + 2);
+                _h->cpu[strcspn(_h->cpu, "\n")] = 0;
+            } else if (strncmp(_line, "microcode", 9) == 0 && _colon) {
+                snprintf(_h->microcode, sizeof(_h->microcode), "%s", _colon + 2);
+                _h->microcode[strcspn(_h->microcode, "\n")] = 0;
+            } else if (_line[0] == '\n') {
+                break; /* end of the first processor */
+            }
+        }
+        fclose(_f);
+    }
+    _bench_build_info(_h);
+    if (!_bench_read_line("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor", _h->governor, sizeof(_h->governor)))
+        _h->governor[0] = 0;
+    if (!_bench_read_line("/sys/devices/system/cpu/isolated", _h->isolated, sizeof(_h->isolated)))
+        _h->isolated[0] = 0;
+    int _no_turbo = _bench_read_int("/sys/devices/system/cpu/intel_pstate/no_turbo");
+    _h->turbo = _no_turbo >= 0 ? !_no_turbo : _bench_read_int("/sys/devices/system/cpu/cpufreq/boost");
+    _h->smt = _bench_read_int("/sys/devices/system/cpu/smt/active");
+    _h->aslr = _bench_read_int("/proc/sys/kernel/randomize_va_space");
+    char _load[128];
+    _h->load[0] = _h->load[1] = _h->load[2] = -1;
+    if (_bench_read_line("/proc/loadavg", _load, sizeof(_load)))
+        sscanf(_load, "%lf %lf %lf", &_h->load[0], &_h->load[1], &_h->load[2]);
+    uint32_t _r[4];
+    _bench_cpuid(0x80000000u, _r);
+    if (_r[0] >= 0x80000007u) {
+        _bench_cpuid(0x80000007u, _r);
+        _h->invariant_tsc = (_r[3] >> 8) & 1;
+    } else {
+        _h->invariant_tsc = -1;
+    }
+    _h->ready = 1;
+    return _h;
+}
+
+#ifndef BENCH_ENV_MAX_LOAD
+#define BENCH_ENV_MAX_LOAD 1.0
+#endif
+
+_BENCH_SHARED int _bench_environment_checked = 0;
+
+/*
+* Warns once, on stderr, about host settings that add noise or bias:
+* a power-saving governor or turbo (frequency varies with load and
+* temperature), SMT (a sibling thread shares the core), ASLR (code and
+* data alignment change between runs), other load, a TSC that is not
+* invariant. Returns the number of warnings.
+*/
+static inline int bench_check_environment(void) {
+    const struct bench_host *_h = bench_host();
+    int _n = 0;
+    if (_bench_environment_checked)
+        return 0;
+    _bench_environment_checked = 1;
+#define _BENCH_ENV_WARN(...) do { \
+    if (!_n++) fprintf(stderr, "bench: noisy environment, results may vary:\n"); \
+    fprintf(stderr, "  - " __VA_ARGS__); \
+} while (0)
+    if (_h->governor[0] && strcmp(_h->governor, "performance") != 0)
+        _BENCH_ENV_WARN("cpufreq governor is %s, not performance\n", _h->governor);
+    if (_h->turbo > 0)
+        _BENCH_ENV_WARN("turbo boost is enabled\n");
+    if (_h->smt > 0)
+        _BENCH_ENV_WARN("SMT is active, sibling hardware threads share cores\n");
+    if (_h->aslr > 0)
+        _BENCH_ENV_WARN("ASLR is enabled (randomize_va_space=%d), alignment changes between runs\n", _h->aslr);
+    if (_h->load[0] > BENCH_ENV_MAX_LOAD)
+        _BENCH_ENV_WARN("load average is %.2f\n", _h->load[0]);
+    if (_h->invariant_tsc == 0)
+        _BENCH_ENV_WARN("TSC is not invariant, RDTSCP cycles follow the core frequency\n");
+#undef _BENCH_ENV_WARN
+    return _n;
+}
+
+/* Prints the host fingerprint and environment; the header of text reports */
+static inline void bench_host_print(FILE *out) {
+    const struct bench_host *_h = bench_host();
+    fprintf(out, "Host     %s, %s, microcode %s\n", _h->hostname, _h->cpu, _h->microcode[0] ? _h->microcode : "unknown");
+    fprintf(out, "Kernel   %s\n", _h->kernel);
+    fprintf(out, "Compiler %s, %s\n", _h->compiler, _h->flags[0] ? _h->flags : "no flags");
+    fprintf(out, "Env      governor %s, turbo %s, SMT %s, ASLR %s, load %.2f, isolcpus %s, invariant TSC %s\n\n",
+            _h->governor[0] ? _h->governor : "unknown",
+            _h->turbo < 0 ? "unknown" : _h->turbo ? "on" : "off",
+            _h->smt < 0 ? "unknown" : _h->smt ? "on" : "off",
+            _h->aslr < 0 ? "unknown" : _h->aslr ? "on" : "off",
+            _h->load[0], _h->isolated[0] ? _h->isolated : "none",
+            _h->invariant_tsc < 0 ? "unknown" : _h->invariant_tsc ? "yes" : "no");
+}
+
+/* Current UTC time as ISO 8601 */
+static inline void _bench_timestamp(char *buf, size_t len) {
+    time_t _now = time(NULL);
+    struct tm _tm;
+    gmtime_r(&_now, &_tm);
+    strftime(buf, len, "%Y-%m-%dT%H:%M:%SZ", &_tm);
+}
+
+/*
+* Numeric fields of a structured record, in a fixed order so every CSV
+* row matches the header. Fields that do not apply are marked invalid
+* and written as null (JSON) or left empty (CSV).
+*/
+struct _bench_field {
+    const char *key;
+    double value;
+    int integer;
+    int valid;
+};
+
+/* Capacity of the field arrays; fields past it are dropped (in every record alike) with a warning */
+#define _BENCH_MAX_FIELDS 96
+
+static inline int _bench_result_fields(const struct bench_result *r, struct _bench_field *f) {
+    int _n = 0, _pct = r->nsamples || r->hist, _rec = r->nsamples > 0;
+#define _BENCH_FIELD(k, v, isint, ok) do { \
+    if (_n < _BENCH_MAX_FIELDS) { \
+        f[_n].key = (k); f[_n].value = (double)(v); f[_n].integer = (isint); f[_n].valid = (ok); _n++; \
+    } else { \
+        fprintf(stderr, "bench: _BENCH_MAX_FIELDS too small, dropping field %s\n", (k)); \
+    } \
+} while (0)
+    _BENCH_FIELD("iterations", r->runs, 1, 1);
+    _BENCH_FIELD("batch", r->batch, 1, 1);
+    _BENCH_FIELD("warmup", r->warmup, 1, 1);
+    _BENCH_FIELD("mean", bench_result_avg(r), 0, r->runs > 0);
+    _BENCH_FIELD("mean_ns", bench_result_ns(r, bench_result_avg(r)), 0, r->runs > 0 && r->timer != BENCH_TIMER_PMC);
+    _BENCH_FIELD("ci95", bench_result_ci95(r), 0, r->runs > 1);
+    _BENCH_FIELD("stderr", bench_result_scale(r, bench_result_stderr_raw(r)), 0, r->runs > 1);
+    _BENCH_FIELD("stddev", bench_result_scale(r, bench_result_stddev_raw(r)), 0, r->runs > 1);
+    _BENCH_FIELD("rse", bench_result_rse(r), 0, r->runs > 1 && r->mean > 0);
+    _BENCH_FIELD("min", bench_result_value(r, (double)r->min), 0, r->runs > 0);
+    _BENCH_FIELD("max", bench_result_value(r, (double)r->max), 0, r->runs > 0);
+    _BENCH_FIELD("p50", bench_result_percentile(r, 50), 0, _pct);
+    _BENCH_FIELD("p90", bench_result_percentile(r, 90), 0, _pct);
+    _BENCH_FIELD("p99", bench_result_percentile(r, 99), 0, _pct);
+    _BENCH_FIELD("p999", bench_result_percentile(r, 99.9), 0, _pct);
+    _BENCH_FIELD("mad", bench_result_scale(r, r->mad), 0, _rec);
+    _BENCH_FIELD("outliers_low_severe", r->outliers_low_severe, 1, _rec);
+    _BENCH_FIELD("outliers_low_mild", r->outliers_low_mild, 1, _rec);
+    _BENCH_FIELD("outliers_high_mild", r->outliers_high_mild, 1, _rec);
+    _BENCH_FIELD("outliers_high_severe", r->outliers_high_severe, 1, _rec);
+    _BENCH_FIELD("floor_min", r->floor.min, 0, 1);
+    _BENCH_FIELD("floor_median", r->floor.median, 0, 1);
+    _BENCH_FIELD("overhead_subtracted", r->offset, 0, 1);
+    _BENCH_FIELD("instructions_per_iteration", bench_result_instructions(r), 0, r->timer == BENCH_TIMER_PMC && r->runs);
+    _BENCH_FIELD("threads", r->threads, 1, r->threads > 0);
+    _BENCH_FIELD("ops_per_sec", bench_result_ops_per_sec(r), 0, r->elapsed_ns > 0);
+    _BENCH_FIELD("speedup", r->speedup, 0, r->speedup > 0);
+    _BENCH_FIELD("efficiency", r->threads ? r->speedup / r->threads : 0, 0, r->speedup > 0);
+    int _rate = r->runs && r->timer != BENCH_TIMER_PMC, _total = r->elapsed_ns > 0 && r->threads > 1;
+    _BENCH_FIELD("bytes_per_iteration", r->bytes, 0, r->bytes > 0);
+    _BENCH_FIELD("bytes_per_sec", bench_result_rate(r, r->bytes, bench_result_avg(r)), 0, r->bytes > 0 && _rate);
+    _BENCH_FIELD("bytes_per_sec_p50", bench_result_rate(r, r->bytes, bench_result_percentile(r, 50)), 0, r->bytes > 0 && _rate && _pct);
+    _BENCH_FIELD("bytes_per_sec_p90", bench_result_rate(r, r->bytes, bench_result_percentile(r, 90)), 0, r->bytes > 0 && _rate && _pct);
+    _BENCH_FIELD("bytes_per_sec_p99", bench_result_rate(r, r->bytes, bench_result_percentile(r, 99)), 0, r->bytes > 0 && _rate && _pct);
+    _BENCH_FIELD("bytes_per_sec_p999", bench_result_rate(r, r->bytes, bench_result_percentile(r, 99.9)), 0, r->bytes > 0 && _rate && _pct);
+    _BENCH_FIELD("bytes_per_sec_total", bench_result_total_rate(r, r->bytes), 0, r->bytes > 0 && _total);
+    _BENCH_FIELD("items_per_iteration", r->items, 0, r->items > 0);
+    _BENCH_FIELD("items_per_sec", bench_result_rate(r, r->items, bench_result_avg(r)), 0, r->items > 0 && _rate);
+    _BENCH_FIELD("items_per_sec_p50", bench_result_rate(r, r->items, bench_result_percentile(r, 50)), 0, r->items > 0 && _rate && _pct);
+    _BENCH_FIELD("items_per_sec_p90", bench_result_rate(r, r->items, bench_result_percentile(r, 90)), 0, r->items > 0 && _rate && _pct);
+    _BENCH_FIELD("items_per_sec_p99", bench_result_rate(r, r->items, bench_result_percentile(r, 99)), 0, r->items > 0 && _rate && _pct);
+    _BENCH_FIELD("items_per_sec_p999", bench_result_rate(r, r->items, bench_result_percentile(r, 99.9)), 0, r->items > 0 && _rate && _pct);
+    _BENCH_FIELD("items_per_sec_total", bench_result_total_rate(r, r->items), 0, r->items > 0 && _total);
+    _BENCH_FIELD("migrated", r->migrated, 1, r->timer == BENCH_TIMER_TSC);
+    _BENCH_FIELD("pinned_cpu", r->pinned_cpu, 1, r->pinned_cpu >= 0);
+    _BENCH_FIELD("sched_fifo", r->fifo, 1, r->fifo > 0);
+    _BENCH_FIELD("cold_vs_hot", r->cold_ratio, 0, r->cold_ratio > 0);
+    _BENCH_FIELD("tsc_ghz", r->timer == BENCH_TIMER_TSC ? 1.0 / bench_tsc_ns_per_cycle() : 0, 0,
+                 r->timer == BENCH_TIMER_TSC);
+    for (int _i = 0; _i < BENCH_PERF_EVENTS; _i++)
+        _BENCH_FIELD(bench_perf_names[_i], r->perf.per_iteration[_i], 0,
+                     r->perf.enabled && !r->perf.error && r->perf.per_iteration[_i] >= 0);
+    _BENCH_FIELD("ipc", r->perf.per_iteration[1] > 0 ? r->perf.per_iteration[0] / r->perf.per_iteration[1] : 0,
+                 0, r->perf.enabled && !r->perf.error && r->perf.per_iteration[0] >= 0 && r->perf.per_iteration[1] > 0);
+    _BENCH_FIELD("ab_ratio", r->ab.ratio, 0, r->ab.versus && r->ab.pairs > 1);
+    _BENCH_FIELD("ab_ratio_lo", r->ab.lo, 0, r->ab.versus && r->ab.pairs > 1);
+    _BENCH_FIELD("ab_ratio_hi", r->ab.hi, 0, r->ab.versus && r->ab.pairs > 1);
+    _BENCH_FIELD("baseline_ratio", r->baseline.ratio, 0, r->baseline.found);
+    _BENCH_FIELD("baseline_p", r->baseline.p, 0, r->baseline.found);
+    _BENCH_FIELD("baseline_regression", r->baseline.regression, 1, r->baseline.found);
+#undef _BENCH_FIELD
+    return _n;
+}
+
+static inline const char *bench_timer_name(int timer) {
+    return timer == BENCH_TIMER_TSC ? "rdtscp" : timer == BENCH_TIMER_PMC ? "rdpmc" : "clock_monotonic_raw";
+}
+
+static inline void _bench_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; s && *s; s++) {
+        unsigned char _c = (unsigned char)*s;
+        if (_c == '"' || _c == '\\')
+            fprintf(out, "\\%c", _c);
+        else if (_c < 0x20)
+            fprintf(out, "\\u%04x", _c);
+        else
+            fputc(_c, out);
+    }
+    fputc('"', out);
+}
+
+/* Shortest %g form that reads back as the same double (17 digits always do) */
+static inline void _bench_print_double(FILE *out, double v) {
+    char _buf[32];
+    for (int _digits = 15; _digits <= 17; _digits++) {
+        snprintf(_buf, sizeof(_buf), "%.*g", _digits, v);
+        if (strtod(_buf, NULL) == v)
+            break;
+    }
+    fputs(_buf, out);
+}
+
+static inline void _bench_json_number(FILE *out, const struct _bench_field *f) {
+    if (!f->valid || isnan(f->value) || isinf(f->value))
+        fputs("null", out);
+    else if (f->integer)
+        fprintf(out, "%.0f", f->value);
+    else
+        _bench_print_double(out, f->value);
+}
+
+/* "key": value pairs shared by the JSON and JSON Lines reporters */
+static inline void _bench_json_result(FILE *out, const struct bench_result *r, const char *sep) {
+    struct _bench_field _f[_BENCH_MAX_FIELDS];
+    int _n = _bench_result_fields(r, _f);
+    fprintf(out, "\"name\":%s", sep);
+    _bench_json_string(out, r->name);
+    fprintf(out, ",%s\"case\":%s", sep, sep);
+    if (_bench_current_case)
+        _bench_json_string(out, _bench_current_case);
+    else
+        fputs("null", out);
+    fprintf(out, ",%s\"unit\":%s\"%s\",%s\"timer\":%s\"%s\"", sep, sep,
+            bench_timer_unit(r->timer), sep, sep, bench_timer_name(r->timer));
+    for (int _i = 0; _i < _n; _i++) {
+        fprintf(out, ",%s\"%s\":%s", sep, _f[_i].key, sep);
+        _bench_json_number(out, &_f[_i]);
+    }
+}
+
+/* "key": value pairs describing the host and time of the run */
+static inline void _bench_json_context(FILE *out, const char *sep) {
+    const struct bench_host *_h = bench_host();
+    char _ts[32];
+    _bench_timestamp(_ts, sizeof(_ts));
+    fprintf(out, "\"host\":%s", sep);
+    _bench_json_string(out, _h->hostname);
+    fprintf(out, ",%s\"cpu\":%s", sep, sep);
+    _bench_json_string(out, _h->cpu);
+    fprintf(out, ",%s\"kernel\":%s", sep, sep);
+    _bench_json_string(out, _h->kernel);
+    fprintf(out, ",%s\"microcode\":%s", sep, sep);
+    _bench_json_string(out, _h->microcode);
+    fprintf(out, ",%s\"compiler\":%s", sep, sep);
+    _bench_json_string(out, _h->compiler);
+    fprintf(out, ",%s\"flags\":%s", sep, sep);
+    _bench_json_string(out, _h->flags);
+    fprintf(out, ",%s\"governor\":%s", sep, sep);
+    _bench_json_string(out, _h->governor);
+    fprintf(out, ",%s\"isolcpus\":%s", sep, sep);
+    _bench_json_string(out, _h->isolated);
+    fprintf(out, ",%s\"turbo\":%s%s", sep, sep, _h->turbo < 0 ? "null" : _h->turbo ? "true" : "false");
+    fprintf(out, ",%s\"smt\":%s%s", sep, sep, _h->smt < 0 ? "null" : _h->smt ? "true" : "false");
+    if (_h->aslr < 0)
+        fprintf(out, ",%s\"aslr\":%snull", sep, sep);
+    else
+        fprintf(out, ",%s\"aslr\":%s%d", sep, sep, _h->aslr);
+    fprintf(out, ",%s\"load_avg\":%s%.2f", sep, sep, _h->load[0]);
+    fprintf(out, ",%s\"invariant_tsc\":%s%s", sep, sep,
+            _h->invariant_tsc < 0 ? "null" : _h->invariant_tsc ? "true" : "false");
+    fprintf(out, ",%s\"timestamp\":%s\"%s\"", sep, sep, _ts);
+}
+
+/* Results written so far to the current output */
+_BENCH_SHARED uint64_t _bench_output_count = 0;
+
+static inline void _bench_text_result(FILE *out, const struct bench_result *r) {
+    if (!_bench_output_count)
+        bench_host_print(out);
+    bench_report(out, r);
+}
+
+static inline void _bench_json_begin(FILE *out) {
+    fputs("{\n  \"context\": {", out);
+    _bench_json_context(out, " ");
+    fputs("},\n  \"benchmarks\": [", out);
+}
+
+static inline void _bench_json_each(FILE *out, const struct bench_result *r) {
+    fputs(_bench_output_count ? ",\n    {" : "\n    {", out);
+    _bench_json_result(out, r, " ");
+    fputs("}", out);
+}
+
+static inline void _bench_json_end(FILE *out) {
+    fputs("\n  ]\n}\n", out);
+}
+
+static inline void _bench_jsonl_each(FILE *out, const struct bench_result *r) {
+    fputc('{', out);
+    _bench_json_result(out, r, "");
+    fputc(',', out);
+    _bench_json_context(out, "");
+    fputs("}\n", out);
+}
+
+static inline void _bench_csv_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; s && *s; s++) {
+        if (*s == '"')
+            fputc('"', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static inline void _bench_csv_each(FILE *out, const struct bench_result *r) {
+    struct _bench_field _f[_BENCH_MAX_FIELDS];
+    int _n = _bench_result_fields(r, _f);
+    const struct bench_host *_h = bench_host();
+    char _ts[32];
+    _bench_timestamp(_ts, sizeof(_ts));
+    if (!_bench_output_count) {
+        fputs("name,case,unit,timer", out);
+        for (int _i = 0; _i < _n; _i++)
+            fprintf(out, ",%s", _f[_i].key);
+        fputs(",host,cpu,kernel,microcode,compiler,flags,timestamp\n", out);
+    }
+    _bench_csv_string(out, r->name);
+    fputc(',', out);
+    _bench_csv_string(out, _bench_current_case ? _bench_current_case : "");
+    fprintf(out, ",%s,%s", bench_timer_unit(r->timer), bench_timer_name(r->timer));
+    for (int _i = 0; _i < _n; _i++) {
+        fputc(',', out);
+        if (!_f[_i].valid || isnan(_f[_i].value) || isinf(_f[_i].value))
+            continue;
+        if (_f[_i].integer)
+            fprintf(out, "%.0f", _f[_i].value);
+        else
+            _bench_print_double(out, _f[_i].value);
+    }
+    fputc(',', out);
+    _bench_csv_string(out, _h->hostname);
+    fputc(',', out);
+    _bench_csv_string(out, _h->cpu);
+    fputc(',', out);
+    _bench_csv_string(out, _h->kernel);
+    fputc(',', out);
+    _bench_csv_string(out, _h->microcode);
+    fputc(',', out);
+    _bench_csv_string(out, _h->compiler);
+    fputc(',', out);
+    _bench_csv_string(out, _h->flags);
+    fprintf(out, ",%s\n", _ts);
+}
+
+static const struct bench_reporter bench_reporter_text = { "text", NULL, _bench_text_result, NULL };
+static const struct bench_reporter bench_reporter_json = {
+    "json", _bench_json_begin, _bench_json_each, _bench_json_end
+};
+static const struct bench_reporter bench_reporter_jsonl = { "jsonl", NULL, _bench_jsonl_each, NULL };
+static const struct bench_reporter bench_reporter_csv = { "csv", NULL, _bench_csv_each, NULL };
+
+/* Built-in reporter by name ("text", "json", "jsonl", "csv"), or NULL */
+static inline const struct bench_reporter *bench_reporter_find(const char *name) {
+    const struct bench_reporter *_all[] = {
+        &bench_reporter_text, &bench_reporter_json, &bench_reporter_jsonl, &bench_reporter_csv,
+    };
+    for (size_t _i = 0; _i < sizeof(_all) / sizeof(_all[0]); _i++)
+        if (strcmp(_all[_i]->name, name) == 0)
+            return _all[_i];
+    return NULL;
+}
+
+/* Output stream and reporter in use, set on the first result */
+_BENCH_SHARED FILE *_bench_output = NULL;
+_BENCH_SHARED const struct bench_reporter *_bench_output_reporter = NULL;
+
+/* Finishes the current output (end callback, close the file); safe to call twice */
+static inline void bench_output_close(void) {
+    if (!_bench_output)
+        return;
+    if (_bench_output_reporter->end)
+        _bench_output_reporter->end(_bench_output);
+    if (_bench_output != stdout)
+        fclose(_bench_output);
+    else
+        fflush(stdout);
+    _bench_output = NULL;
+    _bench_output_count = 0;
+}
+
+/* Hands a finished result to the configured reporter */
+static inline void bench_emit(const struct bench_result *r) {
+    if (!_bench_output) {
+        const struct bench_reporter *_rep = bench_config.reporter ? bench_config.reporter
+                                                                  : &bench_reporter_text;
+        FILE *_f = stdout;
+        if (bench_config.output && !(_f = fopen(bench_config.output, "w"))) {
+            fprintf(stderr, "bench: cannot open %s, writing to stdout\n", bench_config.output);
+            _f = stdout;
+        }
+        static int _registered;
+        if (!_registered) {
+            atexit(bench_output_close);
+            _registered = 1;
+        }
+        _bench_output = _f;
+        _bench_output_reporter = _rep;
+        if (_rep->begin)
+            _rep->begin(_f);
+    }
+    _bench_output_reporter->result(_bench_output, r);
+    _bench_output_count++;
+}
+
+/* Set in the threads of multi-threaded runs, which pin themselves */
+_BENCH_SHARED __thread int _bench_worker;
+
+/*
+* Work declared for the next benchmark with bench_set_bytes() /
+* bench_set_items(): every run started from then on reports throughput,
+* until a result has been reported.
+*/
+_BENCH_SHARED double _bench_work_bytes = 0;
+_BENCH_SHARED double _bench_work_items = 0;
+
+/* Declares the bytes the next benchmark's block processes per execution */
+static inline void bench_set_bytes(double bytes) {
+    _bench_work_bytes = bytes;
+}
+
+/* Declares the items (messages, records, ...) the next benchmark's block processes per execution */
+static inline void bench_set_items(double items) {
+    _bench_work_items = items;
+}
+
+/*
+* Prepares a run; all calibration happens here, outside the loop.
+* With batched set, the batch size is chosen by the first samples.
+*/
+static inline void _bench_run_init(struct bench_run *r, const char *name, int timer,
+                                   uint64_t iterations, int batched) {
+    memset(r, 0, sizeof(*r));
+    r->res.name = name;
+    r->res.timer = timer;
+    r->res.batch = 1;
+    r->res.min = UINT64_MAX;
+    r->iterations = iterations;
+    if (bench_config.check_environment && !_bench_environment_checked)
+        bench_check_environment();
+    r->res.pinned_cpu = -1;
+    if (!_bench_worker) {
+        _bench_sched_apply();
+        r->res.pinned_cpu = _bench_sched.pinned;
+        r->res.fifo = _bench_sched.fifo_active;
+    }
+    r->res.bytes = _bench_work_bytes;
+    r->res.items = _bench_work_items;
+    if (timer == BENCH_TIMER_PMC && !bench_pmc_open()) {
+        /* Keep going with reference cycles rather than failing the suite */
+        r->res.timer = timer = BENCH_TIMER_TSC;
+        r->res.timer_note = "rdpmc unavailable, measured with RDTSCP";
+        fprintf(stderr, "bench: [%s] rdpmc unavailable (%s), using RDTSCP\n", name, bench_pmc_error());
+    }
+    if (timer == BENCH_TIMER_TSC)
+        bench_tsc_ns_per_cycle();
+    r->res.floor = *bench_timer_floor(timer);
+    if (bench_config.subtract_overhead)
+        r->res.offset = r->res.floor.median;
+
+    r->phase = batched ? _BENCH_PHASE_BATCH : _BENCH_PHASE_WARMUP;
+    r->batch_target = (uint64_t)(r->res.floor.median * BENCH_BATCH_FLOOR_FACTOR) + 1;
+    r->batch_best = UINT64_MAX;
+
+    if (iterations == BENCH_AUTO_ITERATIONS) {
+        r->iterations = UINT64_MAX;
+        r->auto_budget_ns = (uint64_t)(bench_config.budget_ms * 1e6);
+        r->auto_rse = bench_config.target_rse;
+        r->auto_next_check = 1;
+    }
+
+    if (bench_config.histogram)
+        r->res.hist = (struct bench_hist *)calloc(1, sizeof(struct bench_hist));
+
+    /* The sample buffer is allocated up front; automatic mode grows it as needed */
+    if (bench_config.record || bench_config.baseline || bench_config.baseline_save) {
+        r->samples_cap = iterations == BENCH_AUTO_ITERATIONS ? 4096 : iterations;
+        r->res.samples = (uint64_t *)malloc(r->samples_cap * sizeof(uint64_t));
+        if (!r->res.samples) {
+            fprintf(stderr, "bench: cannot allocate %lu samples for [%s], not recording\n",
+                    r->samples_cap, name);
+            r->samples_cap = 0;
+        }
+    }
+}
+
+/* Doubles the sample buffer; on failure recording stops and the rest is still summarized */
+static inline int _bench_run_grow_samples(struct bench_run *r) {
+    uint64_t *_s = (uint64_t *)realloc(r->res.samples, 2 * r->samples_cap * sizeof(uint64_t));
+    if (!_s)
+        return 0;
+    r->res.samples = _s;
+    r->samples_cap *= 2;
+    return 1;
+}
+
+/*
+* Automatic mode stop rule: the wall-time budget is spent, or the
+* relative standard error reached its target after at least
+* BENCH_AUTO_MIN_RUNS samples and BENCH_AUTO_MIN_BUDGET of the budget.
+* Evaluated on a schedule
+* growing by 1/8 of the sample count, so it costs a clock read only
+* every few samples and overshoots the budget by at most ~12%.
+*/
+static inline int _bench_auto_done(struct bench_run *r, uint64_t runs, double rse) {
+    if (runs < r->auto_next_check)
+        return 0;
+    r->auto_next_check = runs + (runs / 8 ? runs / 8 : 1);
+    uint64_t _elapsed = _bench_clock_ns() - r->auto_start_ns;
+    if (_elapsed >= r->auto_budget_ns)
+        return 1;
+    return runs >= BENCH_AUTO_MIN_RUNS && _elapsed >= BENCH_AUTO_MIN_BUDGET * r->auto_budget_ns &&
+           rse <= r->auto_rse;
+}
+
+static inline int _bench_run_auto_done(struct bench_run *r) {
+    return _bench_auto_done(r, r->res.runs, bench_result_rse(&r->res));
+}
+
+/* Overrides the automatic mode targets of a run started with BENCH_AUTO_ITERATIONS */
+static inline void _bench_run_set_auto(struct bench_run *r, double budget_ms, double target_rse) {
+    r->auto_budget_ns = (uint64_t)(budget_ms * 1e6);
+    r->auto_rse = target_rse;
+}
+
+/* Enters the measurement phase; the automatic mode budget starts here */
+static inline void _bench_run_start_measure(struct bench_run *r) {
+    if (r->barrier)
+        bench_barrier_wait(r->barrier);
+    r->phase = _BENCH_PHASE_MEASURE;
+    r->auto_start_ns = _bench_clock_ns();
+    if (r->perf)
+        bench_perf_enable(r->perf);
+}
+
+/* Moves to the next phase after batch sizing, skipping warmup when disabled */
+static inline void _bench_run_start_warmup(struct bench_run *r) {
+    _bench_run_start_measure(r);
+    if (bench_config.warmup == BENCH_WARMUP_OFF || bench_config.warmup_window < 2 ||
+        (bench_config.warmup == BENCH_WARMUP_AUTO && !r->auto_budget_ns))
+        return;
+    r->phase = _BENCH_PHASE_WARMUP;
+    r->warmup_deadline_ns = _bench_clock_ns() + (uint64_t)(bench_config.warmup_max_ms * 1e6);
+}
+
+/* Nonzero while the run needs more samples */
+static inline int _bench_run_next(struct bench_run *r) {
+    if (r->phase == _BENCH_PHASE_WARMUP && !r->warmup_deadline_ns)
+        _bench_run_start_warmup(r);
+    if (r->phase == _BENCH_PHASE_MEASURE &&
+        (r->res.runs >= r->iterations || (r->auto_budget_ns && _bench_run_auto_done(r)))) {
+        r->phase = _BENCH_PHASE_DONE;
+        if (r->perf)
+            bench_perf_disable(r->perf);
+    }
+    return r->phase != _BENCH_PHASE_DONE;
+}
+
+/*
+* Batch sizing: the fastest of three samples at the current size must
+* reach batch_target, otherwise the size grows (by the estimated factor,
+* at least doubling) and the samples are discarded.
+*/
+static inline void _bench_run_size_batch(struct bench_run *r, uint64_t delta) {
+    r->batch_best = delta < r->batch_best ? delta : r->batch_best;
+    if (++r->batch_tries < 3)
+        return;
+    if (r->batch_best >= r->batch_target || r->res.batch >= BENCH_BATCH_MAX) {
+        r->phase = _BENCH_PHASE_WARMUP;
+        return;
+    }
+    uint64_t _grow = r->batch_best ? r->batch_target / r->batch_best : BENCH_BATCH_MAX;
+    _grow = _grow < 2 ? 2 : _grow;
+    r->res.batch = r->res.batch > BENCH_BATCH_MAX / _grow ? BENCH_BATCH_MAX : r->res.batch * _grow;
+    r->batch_best = UINT64_MAX;
+    r->batch_tries = 0;
+}
+
+/* Median of n samples; reorders them */
+static inline double _bench_median_u64(uint64_t *s, uint64_t n) {
+    qsort(s, n, sizeof(uint64_t), _bench_cmp_u64);
+    return n % 2 ? (double)s[n / 2] : ((double)s[n / 2 - 1] + (double)s[n / 2]) / 2;
+}
+
+/*
+* Warmup: samples are collected in windows and discarded. The block is
+* considered warm once the medians of two consecutive windows differ by
+* less than bench_config.warmup_tolerance, or when the time limit is hit.
+*/
+static inline void _bench_run_warmup(struct bench_run *r, uint64_t delta) {
+    int _window = bench_config.warmup_window;
+    _window = _window > BENCH_WARMUP_WINDOW_MAX ? BENCH_WARMUP_WINDOW_MAX : _window;
+
+    r->res.warmup++;
+    r->warmup_samples[r->warmup_n++] = delta;
+    if (r->warmup_n < _window) {
+        if (_bench_clock_ns() >= r->warmup_deadline_ns)
+            _bench_run_start_measure(r);
+        return;
+    }
+
+    double _median = _bench_median_u64(r->warmup_samples, r->warmup_n);
+    r->warmup_n = 0;
+    if (r->warmup_median > 0 &&
+        fabs(_median - r->warmup_median) <= bench_config.warmup_tolerance * r->warmup_median) {
+        r->res.warmup_stable = 1;
+        _bench_run_start_measure(r);
+    } else if (_bench_clock_ns() >= r->warmup_deadline_ns) {
+        _bench_run_start_measure(r);
+    }
+    r->warmup_median = _median;
+}
+
+/* Records one sample */
+static inline void _bench_run_add(struct bench_run *r, uint64_t delta) {
+    if (_bench_stamp_migrated(r->res.timer)) {
+        r->res.migrated++;
+        return;
+    }
+    if (r->phase == _BENCH_PHASE_BATCH) {
+        _bench_run_size_batch(r, delta);
+        return;
+    }
+    if (r->phase == _BENCH_PHASE_WARMUP) {
+        _bench_run_warmup(r, delta);
+        return;
+    }
+    r->res.runs++;
+    r->res.total += delta;
+    if (r->res.timer == BENCH_TIMER_PMC)
+        r->res.instructions += _bench_pmc.ins[1] - _bench_pmc.ins[0];
+    r->res.min = delta < r->res.min ? delta : r->res.min;
+    r->res.max = delta > r->res.max ? delta : r->res.max;
+    double _d = (double)delta - r->res.mean;
+    r->res.mean += _d / (double)r->res.runs;
+    r->res.m2 += _d * ((double)delta - r->res.mean);
+    if (r->res.hist)
+        bench_hist_add(r->res.hist, delta);
+    if (r->res.samples && (r->res.nsamples < r->samples_cap || _bench_run_grow_samples(r)))
+        r->res.samples[r->res.nsamples++] = delta;
+}
+
+/*
+* Classifies the (sorted) recorded samples as mild or severe, low or high
+* outliers and summarizes the samples inside the mild fences. Timers are
+* quantized, so the spread is often 0; it is widened to 1% of the median
+* (at least one tick) to keep ordinary jitter from counting as outliers.
+*/
+static inline void _bench_result_outliers(struct bench_result *r) {
+    double _center_lo, _center_hi, _spread;
+    if (bench_config.outlier_method == BENCH_OUTLIERS_MAD) {
+        _center_lo = _center_hi = bench_result_percentile_raw(r, 50);
+        _spread = 1.4826 * r->mad * 2; /* mild at 3 sigma, severe at 6 */
+    } else {
+        _center_lo = bench_result_percentile_raw(r, 25);
+        _center_hi = bench_result_percentile_raw(r, 75);
+        _spread = _center_hi - _center_lo;
+    }
+    double _min_spread = 0.01 * bench_result_percentile_raw(r, 50);
+    _spread = _spread < _min_spread ? _min_spread : _spread;
+    _spread = _spread < 1 ? 1 : _spread;
+    double _mild = 1.5 * _spread, _severe = 3 * _spread;
+
+    r->outliers_low_severe = r->outliers_low_mild = 0;
+    r->outliers_high_mild = r->outliers_high_severe = 0;
+    memset(&r->kept, 0, sizeof(r->kept));
+    r->kept.min = UINT64_MAX;
+    for (uint64_t _i = 0; _i < r->nsamples; _i++) {
+        double _x = (double)r->samples[_i];
+        if (_x < _center_lo - _severe)
+            r->outliers_low_severe++;
+        else if (_x < _center_lo - _mild)
+            r->outliers_low_mild++;
+        else if (_x > _center_hi + _severe)
+            r->outliers_high_severe++;
+        else if (_x > _center_hi + _mild)
+            r->outliers_high_mild++;
+        else {
+            double _d = _x - r->kept.mean;
+            r->kept.runs++;
+            r->kept.mean += _d / (double)r->kept.runs;
+            r->kept.stddev += _d * (_x - r->kept.mean);
+            r->kept.min = r->samples[_i] < r->kept.min ? r->samples[_i] : r->kept.min;
+            r->kept.max = r->samples[_i] > r->kept.max ? r->samples[_i] : r->kept.max;
+        }
+    }
+    r->kept.stddev = r->kept.runs > 1 ? sqrt(r->kept.stddev / (double)(r->kept.runs - 1)) : 0;
+}
+
+/* Sorts recorded samples and derives the order statistics; runs after the loop */
+static inline void _bench_result_summarize(struct bench_result *r) {
+    if (!r->nsamples)
+        return;
+    qsort(r->samples, r->nsamples, sizeof(uint64_t), _bench_cmp_u64);
+    uint64_t *_dev = (uint64_t *)malloc(r->nsamples * sizeof(uint64_t));
+    if (!_dev)
+        return;
+    /* Deviations are doubled so a median halfway between two samples stays exact */
+    uint64_t _median2 = (uint64_t)(2 * bench_result_percentile_raw(r, 50));
+    for (uint64_t _i = 0; _i < r->nsamples; _i++) {
+        uint64_t _x2 = 2 * r->samples[_i];
+        _dev[_i] = _x2 > _median2 ? _x2 - _median2 : _median2 - _x2;
+    }
+    r->mad = _bench_median_u64(_dev, r->nsamples) / 2;
+    free(_dev);
+    _bench_result_outliers(r);
+}
+
+/*
+* Baselines. A baseline file holds, per benchmark, up to
+* BENCH_BASELINE_SAMPLES reported values (per execution, timer floor
+* subtracted when enabled) taken at evenly spaced ranks of the sorted
+* samples, so the distribution survives subsampling. Format, one line per
+* result after "#" header lines fingerprinting the host and build:
+*     name <TAB> unit <TAB> count <TAB> v1 v2 ...
+* Later runs are compared against it with a Mann-Whitney U test, which
+* needs no normality assumption and is insensitive to a few outliers.
+*/
+#ifndef BENCH_BASELINE_SAMPLES
+#define BENCH_BASELINE_SAMPLES 10000
+#endif
+
+struct bench_baseline_entry {
+    char *name;
+    char unit[16];
+    uint64_t n;
+    double *values; /* sorted */
+    struct bench_baseline_entry *next;
+};
+
+_BENCH_SHARED struct bench_baseline_entry *_bench_baseline = NULL;
+_BENCH_SHARED int _bench_baseline_loaded = 0;
+_BENCH_SHARED FILE *_bench_baseline_out = NULL;
+_BENCH_SHARED uint64_t _bench_regressions = 0;
+
+/* Number of results flagged as regressions against the baseline so far */
+static inline uint64_t bench_regressions(void) {
+    return _bench_regressions;
+}
+
+static inline int _bench_cmp_double(const void *a, const void *b) {
+    double _x = *(const double *)a, _y = *(const double *)b;
+    return _x < _y ? -1 : _x > _y;
+}
+
+/* Sorted reported values of a result, subsampled to at most BENCH_BASELINE_SAMPLES */
+static inline double *_bench_baseline_values(const struct bench_result *r, uint64_t *n) {
+    uint64_t _k = r->nsamples < BENCH_BASELINE_SAMPLES ? r->nsamples : BENCH_BASELINE_SAMPLES;
+    double *_v = (double *)malloc((_k ? _k : 1) * sizeof(double));
+    if (!_v)
+        return NULL;
+    for (uint64_t _i = 0; _i < _k; _i++) {
+        uint64_t _at = _k > 1 ? _i * (r->nsamples - 1) / (_k - 1) : 0;
+        _v[_i] = bench_result_value(r, (double)r->samples[_at]);
+    }
+    *n = _k;
+    return _v;
+}
+
+static inline void _bench_baseline_load(void) {
+    _bench_baseline_loaded = 1;
+    FILE *_f = fopen(bench_config.baseline, "r");
+    if (!_f) {
+        fprintf(stderr, "bench: cannot open baseline %s\n", bench_config.baseline);
+        return;
+    }
+    char _name[1024];
+    struct bench_baseline_entry **_tail = &_bench_baseline;
+    int _c;
+    while ((_c = fgetc(_f)) != EOF) {
+        if (_c == '#' || _c == '\n') {
+            while (_c != '\n' && _c != EOF)
+                _c = fgetc(_f);
+            continue;
+        }
+        ungetc(_c, _f);
+        struct bench_baseline_entry *_e =
+            (struct bench_baseline_entry *)calloc(1, sizeof(struct bench_baseline_entry));
+        if (!_e || fscanf(_f, "%1023[^\t]\t%15[^\t]\t%lu", _name, _e->unit, &_e->n) != 3) {
+            fprintf(stderr, "bench: malformed baseline %s\n", bench_config.baseline);
+            free(_e);
+            break;
+        }
+        _e->values = (double *)malloc((_e->n ? _e->n : 1) * sizeof(double));
+        for (uint64_t _i = 0; _e->values && _i < _e->n; _i++)
+            if (fscanf(_f, "%lf", &_e->values[_i]) != 1)
+                _e->n = _i;
+        _e->name = strdup(_name);
+        *_tail = _e;
+        _tail = &_e->next;
+        while ((_c = fgetc(_f)) != '\n' && _c != EOF)
+            ;
+    }
+    fclose(_f);
+}
+
+/*
+* Two-sided p-value of the Mann-Whitney U test on two sorted samples,
+* normal approximation with tie and continuity corrections.
+*/
+static inline double bench_mann_whitney(const double *a, uint64_t na, const double *b, uint64_t nb) {
+    double _n = (double)(na + nb), _rank_a = 0, _ties = 0;
+    uint64_t _i = 0, _j = 0;
+    while (_i < na || _j < nb) {
+        double _v = _j >= nb || (_i < na && a[_i] <= b[_j]) ? a[_i] : b[_j];
+        uint64_t _ca = 0, _cb = 0;
+        while (_i < na && a[_i] == _v) { _i++; _ca++; }
+        while (_j < nb && b[_j] == _v) { _j++; _cb++; }
+        /* Tied values share the average of the ranks they span */
+        double _t = (double)(_ca + _cb);
+        double _first = (double)(_i + _j) - _t + 1;
+        _rank_a += (double)_ca * (_first + (_t - 1) / 2);
+        _ties += _t * _t * _t - _t;
+    }
+    double _u = _rank_a - (double)na * (double)(na + 1) / 2;
+    double _mu = (double)na * (double)nb / 2;
+    double _var = (double)na * (double)nb / 12 * ((_n + 1) - _ties / (_n * (_n - 1)));
+    if (_var <= 0)
+        return 1;
+    double _z = (fabs(_u - _mu) - 0.5) / sqrt(_var);
+    return _z <= 0 ? 1 : erfc(_z / sqrt(2.0));
+}
+
+static inline double _bench_sorted_median(const double *v, uint64_t n) {
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/* Pairs (i, j) of two sorted samples with a[i] - b[j] <= d, in one merge pass */
+static inline uint64_t _bench_pairs_at_most(const double *a, uint64_t na, const double *b, uint64_t nb, double d) {
+    uint64_t _count = 0, _j = 0;
+    for (uint64_t _i = 0; _i < na; _i++) {
+        while (_j < nb && a[_i] - b[_j] > d)
+            _j++;
+        _count += nb - _j;
+    }
+    return _count;
+}
+
+/* k-th smallest (from 1) of the pairwise differences a[i] - b[j], by bisection on the value */
+static inline double _bench_pairs_kth(const double *a, uint64_t na, const double *b, uint64_t nb, uint64_t k) {
+    double _lo = a[0] - b[nb - 1], _hi = a[na - 1] - b[0];
+    if (_bench_pairs_at_most(a, na, b, nb, _lo) >= k)
+        return _lo;
+    /* Invariant: fewer than k pairs at most _lo, at least k at most _hi */
+    for (int _i = 0; _i < 200; _i++) {
+        double _mid = _lo + (_hi - _lo) / 2;
+        if (_mid <= _lo || _mid >= _hi)
+            break;
+        if (_bench_pairs_at_most(a, na, b, nb, _mid) >= k)
+            _hi = _mid;
+        else
+            _lo = _mid;
+    }
+    return _hi;
+}
+
+/*
+* Hodges-Lehmann shift between two sorted samples: the median of all
+* pairwise differences a[i] - b[j], the location estimate that goes with
+* the Mann-Whitney U test. Found without listing the na * nb differences.
+*/
+static inline double bench_hodges_lehmann(const double *a, uint64_t na, const double *b, uint64_t nb) {
+    uint64_t _n = na * nb;
+    if (!_n)
+        return 0;
+    double _lower = _bench_pairs_kth(a, na, b, nb, (_n + 1) / 2);
+    return _n % 2 ? _lower : (_lower + _bench_pairs_kth(a, na, b, nb, _n / 2 + 1)) / 2;
+}
+
+/* Compares a finished result with the baseline entry of the same name */
+static inline void _bench_baseline_compare(struct bench_result *r) {
+    if (!_bench_baseline_loaded)
+        _bench_baseline_load();
+    const char *_unit = bench_timer_unit(r->timer);
+    struct bench_baseline_entry *_e = _bench_baseline;
+    while (_e && (strcmp(_e->name, r->name) != 0 || strcmp(_e->unit, _unit) != 0))
+        _e = _e->next;
+    uint64_t _n = 0;
+    double *_v = _e && _e->n ? _bench_baseline_values(r, &_n) : NULL;
+    if (!_v || !_n) {
+        free(_v);
+        return;
+    }
+    double _before = _bench_sorted_median(_e->values, _e->n);
+    double _shift = bench_hodges_lehmann(_v, _n, _e->values, _e->n);
+    r->baseline.found = 1;
+    r->baseline.ratio = _before > 0 ? 1 + _shift / _before : 1;
+    r->baseline.p = bench_mann_whitney(_v, _n, _e->values, _e->n);
+    if (r->baseline.p < bench_config.significance) {
+        /*
+        * Quantized timers can leave the shift at 0 under a significant
+        * test; the direction then comes from the test itself: more pairs
+        * with now above baseline than below means slower
+        */
+        uint64_t _below = _n * _e->n - _bench_pairs_at_most(_e->values, _e->n, _v, _n, 0);
+        uint64_t _above = _n * _e->n - _bench_pairs_at_most(_v, _n, _e->values, _e->n, 0);
+        r->baseline.verdict = _shift > 0 ? 1 : _shift < 0 ? -1 : _above > _below ? 1 : _above < _below ? -1 : 0;
+    }
+    r->baseline.regression = r->baseline.verdict > 0 &&
+                             r->baseline.ratio - 1 > bench_config.regression_threshold;
+    _bench_regressions += (uint64_t)r->baseline.regression;
+    free(_v);
+}
+
+/* Appends a finished result to the baseline being saved */
+static inline void _bench_baseline_save(const struct bench_result *r) {
+    if (!_bench_baseline_out) {
+        if (!(_bench_baseline_out = fopen(bench_config.baseline_save, "w"))) {
+            fprintf(stderr, "bench: cannot write baseline %s\n", bench_config.baseline_save);
+            bench_config.baseline_save = NULL;
+            return;
+        }
+        const struct bench_host *_h = bench_host();
+        fprintf(_bench_baseline_out, "# bench baseline cpu=%s\n# microcode=%s\n# kernel=%s\n# compiler=%s\n# flags=%s\n",
+                _h->cpu, _h->microcode, _h->kernel, _h->compiler, _h->flags);
+    }
+    uint64_t _n = 0;
+    double *_v = _bench_baseline_values(r, &_n);
+    if (!_v)
+        return;
+    fprintf(_bench_baseline_out, "%s\t%s\t%lu\t", r->name,
+            bench_timer_unit(r->timer), _n);
+    for (uint64_t _i = 0; _i < _n; _i++) {
+        if (_i)
+            fputc(' ', _bench_baseline_out);
+        _bench_print_double(_bench_baseline_out, _v[_i]);
+    }
+    fputc('\n', _bench_baseline_out);
+    fflush(_bench_baseline_out);
+    free(_v);
+}
+
+/* Summarizes, compares, reports and saves a result, then frees its buffers */
+static inline void _bench_result_finish(struct bench_result *r) {
+    _bench_result_summarize(r);
+    if (bench_config.baseline && r->nsamples)
+        _bench_baseline_compare(r);
+    bench_emit(r);
+    if (bench_config.baseline_save && r->nsamples)
+        _bench_baseline_save(r);
+    free(r->samples);
+    r->samples = NULL;
+    free(r->hist);
+    r->hist = NULL;
+    _bench_work_bytes = _bench_work_items = 0;
+}
+
+static inline void _bench_run_finish(struct bench_run *r) {
+    _bench_result_finish(&r->res);
+}
+
+/*
+* Measurement loop shared by the BENCH macros. Timestamps are taken
+* directly around the block; bookkeeping between samples is outside them.
+*/
+#define _BENCH_LOOP(TIMER, code) \
+    while (_bench_run_next(&_bench_r)) { \
+        uint64_t _bench_t0, _bench_t1; \
+        _BENCH_START_##TIMER(&_bench_r, _bench_t0); \
+        { code; } \
+        _BENCH_STOP_##TIMER(&_bench_r, _bench_t1); \
+        _bench_run_add(&_bench_r, _bench_t1 - _bench_t0); \
+    }
+
+/* Same as _BENCH_LOOP, running the block _bench_r.res.batch times per sample */
+#define _BENCH_LOOP_BATCH(TIMER, code) \
+    while (_bench_run_next(&_bench_r)) { \
+        uint64_t _bench_t0, _bench_t1; \
+        uint64_t _bench_k = _bench_r.res.batch; \
+        _BENCH_START_##TIMER(&_bench_r, _bench_t0); \
+        for (; _bench_k; _bench_k--) { code; } \
+        _BENCH_STOP_##TIMER(&_bench_r, _bench_t1); \
+        _bench_run_add(&_bench_r, _bench_t1 - _bench_t0); \
+    }
+
+/*
+* Same as _BENCH_LOOP with per-execution setup and teardown blocks kept
+* outside the timestamps. The compiler barriers stop memory accesses from
+* moving between the setup/teardown and the measured block.
+*/
+#define _BENCH_LOOP_SETUP(TIMER, setup, code, teardown) \
+    while (_bench_run_next(&_bench_r)) { \
+        uint64_t _bench_t0, _bench_t1; \
+        { setup; } \
+        bench_clobber_memory(); \
+        _BENCH_START_##TIMER(&_bench_r, _bench_t0); \
+        { code; } \
+        _BENCH_STOP_##TIMER(&_bench_r, _bench_t1); \
+        bench_clobber_memory(); \
+        { teardown; } \
+        _bench_run_add(&_bench_r, _bench_t1 - _bench_t0); \
+    }
 
 /*
 * Macro for measuring execution time of a code block in nanoseconds.
@@ -37,41 +2353,13 @@
 * - Avoids instruction reordering via memory barrier
 * - Calculates min/max/average time
 * - Zero overhead outside the measured area
+* - Reports the timer floor, optionally subtracted (bench_config.subtract_overhead)
 */
 #define BENCH(name, code, iterations) do { \
-    struct timespec _bench_start, _bench_end; \
-    uint64_t _bench_min = UINT64_MAX, _bench_max = 0, _bench_total = 0; \
-    \
-    /* Main measurement loop */ \
-    for (int _bench_i = 0; _bench_i < iterations; _bench_i++) { \
-        /* Memory barrier and getting time BEFORE code execution */ \
-        asm volatile ("" ::: "memory"); \
-        clock_gettime(CLOCK_MONOTONIC_RAW, &_bench_start); \
-        \
-        /* Code block to be measured */ \
-        { code; } \
-        \
-        /* Memory barrier and getting time AFTER code execution */ \
-        asm volatile ("" ::: "memory"); \
-        clock_gettime(CLOCK_MONOTONIC_RAW, &_bench_end); \
-        \
-        /* Runtime calculations */ \
-        uint64_t _bench_ns = ((_bench_end.tv_sec - _bench_start.tv_sec) * 1000000000ULL) \
-                            + (_bench_end.tv_nsec - _bench_start.tv_nsec); \
-        \
-        /* Updating statistics */ \
-        _bench_total += _bench_ns; \
-        _bench_min = _bench_ns < _bench_min ? _bench_ns : _bench_min; \
-        _bench_max = _bench_ns > _bench_max ? _bench_ns : _bench_max; \
-    } \
-    \
-    /* Output results */ \
-    printf("[%s]\nAvg     %7.2fns\nMin     %6luns\nMax     %6luns\nRuns     %d\n\n", \
-           name, \
-           (double)_bench_total / iterations, \
-           _bench_min, \
-           _bench_max, \
-           iterations); \
+    struct bench_run _bench_r; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_CLOCK, (uint64_t)(iterations), 0); \
+    _BENCH_LOOP(CLOCK, code) \
+    _bench_run_finish(&_bench_r); \
 } while(0)
 
 /*
@@ -82,53 +2370,1263 @@
 * - Uses RDTSCP instead of RDTSC for pipeline serialization
 * - Measures CPU cycles directly
 * - Does not depend on the system clock
-* - Requires calibration on systems with dynamic frequency
+* - Reports nanoseconds too, using a TSC frequency calibrated once
+*   against CLOCK_MONOTONIC_RAW (see bench_tsc_calibrate())
 */
 #define BENCH_RDTSC(name, code, iterations) do { \
-    uint64_t _bench_start, _bench_end; \
-    uint64_t _bench_min = UINT64_MAX, _bench_max = 0, _bench_total = 0; \
-    \
-    for (int _bench_i = 0; _bench_i < iterations; _bench_i++) { \
-        /* Read TSC with serialization (RDTSCP + registers) */ \
-        asm volatile ( \
-            "RDTSCP\n" /* Read the counter and processor ID */ \
-            "shl $32, %%rdx\n" /* Shift the upper 32 bits */ \
-            "or %%rdx, %%rax\n" /* Combine into 64-bit value */ \
-            "mov %%rax, %0" \
-            : "=m" (_bench_start) \
-            : \
-            : "rax", "rdx", "rcx" \
-        ); \
-        \
-        /* Barrier for isolating the measured code */ \
-        asm volatile ("" ::: "memory"); \
-        { code; } \
-        asm volatile ("" ::: "memory"); \
-        \
-        /* Re-read TSC */ \
-        asm volatile ( \
-            "RDTSCP\n" \
-            "shl $32, %%rdx\n" \
-            "or %%rdx, %%rax\n" \
-            "mov %%rax, %0" \
-            : "=m" (_bench_end) \
-            : \
-            : "rax", "rdx", "rcx" \
-        ); \
-        \
-        /* Calculate cycles */ \
-        uint64_t _bench_cycles = _bench_end - _bench_start; \
-        _bench_total += _bench_cycles; \
-        _bench_min = _bench_cycles < _bench_min ? _bench_cycles : _bench_min; \
-        _bench_max = _bench_cycles > _bench_max ? _bench_cycles : _bench_max; \
+    struct bench_run _bench_r; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_TSC, (uint64_t)(iterations), 0); \
+    _BENCH_LOOP(TSC, code) \
+    _bench_run_finish(&_bench_r); \
+} while(0)
+
+/*
+* BENCH_BATCH / BENCH_RDTSC_BATCH - batched versions for blocks too short
+* to time individually (a single instruction, a hash, an atomic).
+* The block runs K times between the two timestamps and every statistic
+* is reported per execution. K is picked automatically before the
+* measurement so each sample lasts BENCH_BATCH_FLOOR_FACTOR timer floors.
+*
+* iterations counts samples, so the block runs iterations * K times.
+* Min/Max are per-execution averages within a sample, not single runs.
+*/
+#define BENCH_BATCH(name, code, iterations) do { \
+    struct bench_run _bench_r; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_CLOCK, (uint64_t)(iterations), 1); \
+    _BENCH_LOOP_BATCH(CLOCK, code) \
+    _bench_run_finish(&_bench_r); \
+} while(0)
+
+#define BENCH_RDTSC_BATCH(name, code, iterations) do { \
+    struct bench_run _bench_r; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_TSC, (uint64_t)(iterations), 1); \
+    _BENCH_LOOP_BATCH(TSC, code) \
+    _bench_run_finish(&_bench_r); \
+} while(0)
+
+/*
+* BENCH_SETUP / BENCH_RDTSC_SETUP - run setup before and teardown after
+* every execution of the block, untimed. For destructive operations:
+* refill the array a sort consumes, push what the block pops, free what
+* it allocates. Warmup executions run them too.
+*
+*     BENCH_SETUP("qsort 1k", { memcpy(a, unsorted, sizeof(a)); },
+*                 { qsort(a, 1024, sizeof(int), cmp); }, {}, 1000);
+*
+* Each execution is timed individually (no batching), so blocks should
+* last well above the timer floor.
+*/
+#define BENCH_SETUP(name, setup, code, teardown, iterations) do { \
+    struct bench_run _bench_r; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_CLOCK, (uint64_t)(iterations), 0); \
+    _BENCH_LOOP_SETUP(CLOCK, setup, code, teardown) \
+    _bench_run_finish(&_bench_r); \
+} while(0)
+
+#define BENCH_RDTSC_SETUP(name, setup, code, teardown, iterations) do { \
+    struct bench_run _bench_r; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_TSC, (uint64_t)(iterations), 0); \
+    _BENCH_LOOP_SETUP(TSC, setup, code, teardown) \
+    _bench_run_finish(&_bench_r); \
+} while(0)
+
+/*
+* BENCH_AUTO / BENCH_RDTSC_AUTO - pick the iteration count automatically.
+* Samples are taken until the wall-time budget (milliseconds, counted
+* from the end of warmup) is spent or the relative standard error of the mean
+* drops below target_rse (0.01 = 1%), whichever comes first. The error
+* target only counts after BENCH_AUTO_MIN_RUNS samples and
+* BENCH_AUTO_MIN_BUDGET of the budget; target_rse 0 always uses the budget.
+*
+* Any other macro accepts BENCH_AUTO_ITERATIONS as its iteration count
+* to use bench_config.budget_ms and bench_config.target_rse instead.
+*/
+#define BENCH_AUTO(name, code, budget_ms, target_rse) do { \
+    struct bench_run _bench_r; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_CLOCK, BENCH_AUTO_ITERATIONS, 0); \
+    _bench_run_set_auto(&_bench_r, budget_ms, target_rse); \
+    _BENCH_LOOP(CLOCK, code) \
+    _bench_run_finish(&_bench_r); \
+} while(0)
+
+#define BENCH_RDTSC_AUTO(name, code, budget_ms, target_rse) do { \
+    struct bench_run _bench_r; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_TSC, BENCH_AUTO_ITERATIONS, 0); \
+    _bench_run_set_auto(&_bench_r, budget_ms, target_rse); \
+    _BENCH_LOOP(TSC, code) \
+    _bench_run_finish(&_bench_r); \
+} while(0)
+
+/*
+* Benchmark registry. BENCH_CASE(id) defines a function whose body runs
+* one or more BENCH macros and registers it under the name "id" before
+* main() starts, in definition order within each file:
+*
+*     BENCH_CASE(memcpy_4k) {
+*         static char src[4096], dst[4096];
+*         BENCH("memcpy 4k", { memcpy(dst, src, sizeof(src)); }, 10000);
+*     }
+*
+*     BENCH_MAIN()
+*
+* Setup code in the body only runs when the case is selected.
+*/
+typedef void (*bench_case_fn)(void);
+
+struct bench_case {
+    const char *name;
+    bench_case_fn fn;
+    const char *file;
+    int line;
+    struct bench_case *next;
+};
+
+_BENCH_SHARED struct bench_case *_bench_cases = NULL;
+_BENCH_SHARED struct bench_case *_bench_cases_last = NULL;
+
+/* Appends a case to the registry; called from load-time constructors */
+static inline void bench_register(struct bench_case *c) {
+    c->next = NULL;
+    if (_bench_cases_last)
+        _bench_cases_last->next = c;
+    else
+        _bench_cases = c;
+    _bench_cases_last = c;
+}
+
+#define BENCH_CASE(id) \
+    static void _bench_case_fn_##id(void); \
+    static struct bench_case _bench_case_##id = { #id, _bench_case_fn_##id, __FILE__, __LINE__, NULL }; \
+    __attribute__((constructor)) static void _bench_case_register_##id(void) { \
+        bench_register(&_bench_case_##id); \
+    } \
+    static void _bench_case_fn_##id(void)
+
+/* Matches option "--key=value" in arg and returns value, or NULL */
+static inline const char *_bench_opt(const char *arg, const char *key) {
+    size_t _n = strlen(key);
+    return strncmp(arg, key, _n) == 0 && arg[_n] == '=' ? arg + _n + 1 : NULL;
+}
+
+static inline void _bench_usage(const char *prog) {
+    printf("usage: %s [options] [REGEX]\n"
+           "  --list                 list registered benchmarks and exit\n"
+           "  --filter=REGEX         run benchmarks whose name matches (POSIX extended regex)\n"
+           "  --record               record every sample (percentiles, MAD, outliers)\n"
+           "  --histogram            keep a latency histogram and plot it\n"
+           "  --drop-outliers        also report statistics without outliers\n"
+           "  --subtract-overhead    subtract the timer floor from statistics\n"
+           "  --warmup               warm up fixed-iteration runs too, not only automatic ones\n"
+           "  --no-warmup            skip the warmup phase\n"
+           "  --budget-ms=MS         time budget for BENCH_AUTO_ITERATIONS runs\n"
+           "  --target-rse=FRACTION  error target for BENCH_AUTO_ITERATIONS runs\n"
+           "  --format=FORMAT        text, json, jsonl or csv\n"
+           "  --output=FILE          write results to FILE instead of stdout\n"
+           "  --save-baseline=FILE   save recorded samples of every result to FILE\n"
+           "  --baseline=FILE        compare results against FILE, exit 1 on regressions\n"
+           "  --threshold=FRACTION   slowdown counted as a regression (default 0.05)\n"
+           "  --pin-cpu=N            run benchmarks on CPU N only\n"
+           "  --fifo[=PRIORITY]      run benchmarks under SCHED_FIFO (default priority 1)\n"
+           "  --no-env-check         do not warn about noisy host settings\n",
+           prog);
+}
+
+/*
+* Entry point for suites of registered cases: parses options into
+* bench_config, then lists or runs the cases selected by the filter.
+* Returns the process exit status.
+*/
+static inline int bench_main(int argc, char **argv) {
+    const char *_filter = NULL, *_v;
+    int _list = 0;
+    for (int _i = 1; _i < argc; _i++) {
+        const char *_a = argv[_i];
+        if (strcmp(_a, "--list") == 0) _list = 1;
+        else if (strcmp(_a, "--record") == 0) bench_config.record = 1;
+        else if (strcmp(_a, "--histogram") == 0) bench_config.histogram = 1;
+        else if (strcmp(_a, "--drop-outliers") == 0) bench_config.drop_outliers = 1;
+        else if (strcmp(_a, "--subtract-overhead") == 0) bench_config.subtract_overhead = 1;
+        else if (strcmp(_a, "--warmup") == 0) bench_config.warmup = BENCH_WARMUP_ON;
+        else if (strcmp(_a, "--no-warmup") == 0) bench_config.warmup = BENCH_WARMUP_OFF;
+        else if (strcmp(_a, "--no-env-check") == 0) bench_config.check_environment = 0;
+        else if ((_v = _bench_opt(_a, "--filter"))) _filter = _v;
+        else if ((_v = _bench_opt(_a, "--budget-ms"))) bench_config.budget_ms = atof(_v);
+        else if ((_v = _bench_opt(_a, "--target-rse"))) bench_config.target_rse = atof(_v);
+        else if ((_v = _bench_opt(_a, "--output"))) bench_config.output = _v;
+        else if ((_v = _bench_opt(_a, "--save-baseline"))) bench_config.baseline_save = _v;
+        else if ((_v = _bench_opt(_a, "--baseline"))) bench_config.baseline = _v;
+        else if ((_v = _bench_opt(_a, "--threshold"))) bench_config.regression_threshold = atof(_v);
+        else if ((_v = _bench_opt(_a, "--pin-cpu"))) bench_config.pin_cpu = atoi(_v);
+        else if ((_v = _bench_opt(_a, "--fifo"))) bench_config.fifo = atoi(_v);
+        else if (strcmp(_a, "--fifo") == 0) bench_config.fifo = 1;
+        else if ((_v = _bench_opt(_a, "--format"))) {
+            if (!(bench_config.reporter = bench_reporter_find(_v))) {
+                fprintf(stderr, "bench: unknown format %s\n", _v);
+                return 2;
+            }
+        }
+        else if (strcmp(_a, "--help") == 0 || strcmp(_a, "-h") == 0) {
+            _bench_usage(argv[0]);
+            return 0;
+        } else if (_a[0] != '-') _filter = _a;
+        else {
+            fprintf(stderr, "bench: unknown option %s\n", _a);
+            _bench_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    regex_t _re;
+    if (_filter && regcomp(&_re, _filter, REG_EXTENDED | REG_NOSUB) != 0) {
+        fprintf(stderr, "bench: invalid filter regex: %s\n", _filter);
+        return 2;
+    }
+    int _matched = 0;
+    for (struct bench_case *_c = _bench_cases; _c; _c = _c->next) {
+        if (_filter && regexec(&_re, _c->name, 0, NULL, 0) != 0)
+            continue;
+        _matched++;
+        if (_list) {
+            printf("%s  (%s:%d)\n", _c->name, _c->file, _c->line);
+        } else {
+            _bench_current_case = _c->name;
+            _c->fn();
+            _bench_current_case = NULL;
+        }
+    }
+    bench_output_close();
+    if (_filter)
+        regfree(&_re);
+    if (!_matched) {
+        fprintf(stderr, "bench: no benchmark matches %s\n", _filter ? _filter : "(all)");
+        return 1;
+    }
+    if (_bench_regressions) {
+        fprintf(stderr, "bench: %lu regression(s) against %s\n", _bench_regressions, bench_config.baseline);
+        return 1;
+    }
+    return 0;
+}
+
+/* Defines main() running the registered cases (see bench_main()) */
+#define BENCH_MAIN() \
+    int main(int argc, char **argv) { return bench_main(argc, argv); }
+
+/*
+* Interleaved A/B runs. Each round runs both blocks once, in random
+* order, so drift in frequency, temperature and cache state hits both
+* alike. Each block keeps its own statistics and recording, but the
+* phases are shared: a block that settles first keeps running (and
+* discarding) warmup rounds until the other one has settled too, both
+* start measuring in the same round, and one stop rule ends both.
+* Rounds where both recorded a sample form a pair, and the log of the
+* B/A ratio of each pair feeds a running mean for the paired ratio.
+*/
+struct bench_ab {
+    struct bench_run run[2];
+    char names[2][256];
+    uint64_t rng;
+    int order[2], step, which;
+    int measuring;           /* both blocks warmed up, samples are recorded */
+    int has[2];              /* sample recorded for this block in this round */
+    double value[2];
+    uint64_t pairs;
+    double log_mean, log_m2; /* Welford over log(B/A) */
+};
+
+static inline void _bench_ab_init(struct bench_ab *ab, const char *name, int timer,
+                                  uint64_t iterations) {
+    snprintf(ab->names[0], sizeof(ab->names[0]), "%s [A]", name);
+    snprintf(ab->names[1], sizeof(ab->names[1]), "%s [B]", name);
+    _bench_run_init(&ab->run[0], ab->names[0], timer, iterations, 0);
+    _bench_run_init(&ab->run[1], ab->names[1], timer, iterations, 0);
+    _bench_run_start_warmup(&ab->run[0]);
+    _bench_run_start_warmup(&ab->run[1]);
+    ab->rng = _bench_rdtscp(NULL) | 1;
+    ab->step = 2;
+    ab->measuring = 0;
+    ab->has[0] = ab->has[1] = 0;
+    ab->pairs = 0;
+    ab->log_mean = ab->log_m2 = 0;
+}
+
+/* Closes a round: pairs its two samples when both were recorded */
+static inline void _bench_ab_pair(struct bench_ab *ab) {
+    if (ab->has[0] && ab->has[1] && ab->value[0] > 0 && ab->value[1] > 0) {
+        double _x = log(ab->value[1] / ab->value[0]);
+        double _d = _x - ab->log_mean;
+        ab->pairs++;
+        ab->log_mean += _d / (double)ab->pairs;
+        ab->log_m2 += _d * (_x - ab->log_mean);
+    }
+    ab->has[0] = ab->has[1] = 0;
+}
+
+/*
+* Stop rule shared by both blocks: the iteration count reached by both,
+* or in automatic mode the budget, or the error target met by both
+* (checked on A's schedule and clock, which started with B's)
+*/
+static inline int _bench_ab_done(struct bench_ab *ab) {
+    struct bench_result *_a = &ab->run[0].res, *_b = &ab->run[1].res;
+    uint64_t _runs = _a->runs < _b->runs ? _a->runs : _b->runs;
+    if (_runs >= ab->run[0].iterations)
+        return 1;
+    if (!ab->run[0].auto_budget_ns)
+        return 0;
+    double _rse_a = bench_result_rse(_a), _rse_b = bench_result_rse(_b);
+    return _bench_auto_done(&ab->run[0], _runs, _rse_a > _rse_b ? _rse_a : _rse_b);
+}
+
+/* Picks the block to run next; 0 once the shared stop rule ends both runs */
+static inline int _bench_ab_next(struct bench_ab *ab) {
+    if (ab->step == 2) {
+        _bench_ab_pair(ab);
+        if (!ab->measuring && ab->run[0].phase == _BENCH_PHASE_MEASURE &&
+            ab->run[1].phase == _BENCH_PHASE_MEASURE) {
+            _bench_run_start_measure(&ab->run[0]);
+            _bench_run_start_measure(&ab->run[1]);
+            ab->measuring = 1;
+        }
+        if (ab->measuring && _bench_ab_done(ab)) {
+            ab->run[0].phase = ab->run[1].phase = _BENCH_PHASE_DONE;
+            return 0;
+        }
+        ab->rng ^= ab->rng << 13;
+        ab->rng ^= ab->rng >> 7;
+        ab->rng ^= ab->rng << 17;
+        ab->order[0] = (int)(ab->rng & 1);
+        ab->order[1] = !ab->order[0];
+        ab->step = 0;
+    }
+    ab->which = ab->order[ab->step++];
+    return 1;
+}
+
+static inline void _bench_ab_add(struct bench_ab *ab, uint64_t delta) {
+    struct bench_run *_r = &ab->run[ab->which];
+    if (!ab->measuring && _r->phase == _BENCH_PHASE_MEASURE) {
+        /* Settled, waiting for the other block */
+        _r->res.warmup++;
+        return;
+    }
+    if (ab->measuring && !_bench_stamp_migrated(_r->res.timer)) {
+        ab->has[ab->which] = 1;
+        ab->value[ab->which] = bench_result_value(&_r->res, (double)delta);
+    }
+    _bench_run_add(_r, delta);
+}
+
+static inline void _bench_ab_finish(struct bench_ab *ab) {
+    _bench_ab_pair(ab);
+    struct bench_result *_b = &ab->run[1].res;
+    _b->ab.versus = ab->names[0];
+    _b->ab.pairs = ab->pairs;
+    if (ab->pairs > 1) {
+        double _se = sqrt(ab->log_m2 / (double)(ab->pairs - 1) / (double)ab->pairs);
+        double _t = bench_t95(ab->pairs - 1);
+        _b->ab.ratio = exp(ab->log_mean);
+        _b->ab.lo = exp(ab->log_mean - _t * _se);
+        _b->ab.hi = exp(ab->log_mean + _t * _se);
+    }
+    _bench_run_finish(&ab->run[0]);
+    _bench_run_finish(&ab->run[1]);
+}
+
+#define _BENCH_LOOP_AB(TIMER, code_a, code_b) \
+    while (_bench_ab_next(&_bench_ab)) { \
+        uint64_t _bench_t0, _bench_t1; \
+        if (_bench_ab.which == 0) { \
+            _BENCH_START_##TIMER(&_bench_ab.run[0], _bench_t0); \
+            { code_a; } \
+            _BENCH_STOP_##TIMER(&_bench_ab.run[0], _bench_t1); \
+        } else { \
+            _BENCH_START_##TIMER(&_bench_ab.run[1], _bench_t0); \
+            { code_b; } \
+            _BENCH_STOP_##TIMER(&_bench_ab.run[1], _bench_t1); \
+        } \
+        _bench_ab_add(&_bench_ab, _bench_t1 - _bench_t0); \
+    }
+
+/*
+* BENCH_AB / BENCH_RDTSC_AB - compare two code blocks in one interleaved
+* loop. Reports "name [A]" and "name [B]" as separate results, and with
+* B the geometric-mean ratio B/A over paired rounds with its 95%
+* confidence interval (below 1 means B is faster).
+*
+* iterations counts samples per block; BENCH_AUTO_ITERATIONS works too.
+*/
+#define BENCH_AB(name, code_a, code_b, iterations) do { \
+    struct bench_ab _bench_ab; \
+    _bench_ab_init(&_bench_ab, name, BENCH_TIMER_CLOCK, (uint64_t)(iterations)); \
+    _BENCH_LOOP_AB(CLOCK, code_a, code_b) \
+    _bench_ab_finish(&_bench_ab); \
+} while(0)
+
+#define BENCH_RDTSC_AB(name, code_a, code_b, iterations) do { \
+    struct bench_ab _bench_ab; \
+    _bench_ab_init(&_bench_ab, name, BENCH_TIMER_TSC, (uint64_t)(iterations)); \
+    _BENCH_LOOP_AB(TSC, code_a, code_b) \
+    _bench_ab_finish(&_bench_ab); \
+} while(0)
+
+/*
+* Counter cost of the measurement harness itself (timer reads, barriers,
+* bookkeeping) per sample, measured by running the same loop with an
+* empty block under the same bench_config. Subtracted from the counts of
+* BENCH_PERF so they describe the block alone.
+*/
+static inline void _bench_perf_harness(struct bench_perf *p, int timer, uint64_t iterations,
+                                       double *per_sample) {
+    struct bench_run _bench_r;
+    _bench_run_init(&_bench_r, "perf harness", timer,
+                    iterations && iterations < 10000 ? iterations : 10000, 0);
+    _bench_r.perf = p;
+    if (timer == BENCH_TIMER_PMC)
+        _BENCH_LOOP(PMC, )
+    else if (timer == BENCH_TIMER_TSC)
+        _BENCH_LOOP(TSC, )
+    else
+        _BENCH_LOOP(CLOCK, )
+    for (int _i = 0; _i < BENCH_PERF_EVENTS; _i++)
+        per_sample[_i] = p->count[_i] >= 0 && _bench_r.res.runs ? p->count[_i] / (double)_bench_r.res.runs : -1;
+    free(_bench_r.res.samples);
+    free(_bench_r.res.hist);
+}
+
+/* Opens the counters of a run and measures the harness; before the loop */
+static inline void _bench_run_perf_init(struct bench_run *r, struct bench_perf *p, double *harness) {
+    r->res.perf.enabled = 1;
+    if (!bench_perf_open(p)) {
+        r->res.perf.error = p->error;
+        return;
+    }
+    _bench_perf_harness(p, r->res.timer, r->iterations == UINT64_MAX ? 0 : r->iterations, harness);
+    r->perf = p;
+}
+
+/* Per-iteration counts of the block; after the loop */
+static inline void _bench_run_perf_finish(struct bench_run *r, const double *harness) {
+    if (!r->perf)
+        return;
+    for (int _i = 0; _i < BENCH_PERF_EVENTS; _i++) {
+        double _v = -1;
+        if (r->perf->count[_i] >= 0 && harness[_i] >= 0 && r->res.runs) {
+            _v = r->perf->count[_i] / (double)r->res.runs - harness[_i];
+            _v = _v > 0 ? _v : 0;
+        }
+        r->res.perf.per_iteration[_i] = _v;
+    }
+    bench_perf_close(r->perf);
+    r->perf = NULL;
+}
+
+/*
+* BENCH_PERF / BENCH_RDTSC_PERF - BENCH / BENCH_RDTSC that also count
+* instructions, core cycles, branch misses, L1d, LLC and dTLB read misses
+* around the block and report them per iteration, with IPC. Counts come
+* from perf_event_open (user space only); the harness cost measured with
+* an empty block is subtracted. Events the host (or a VM, or
+* kernel.perf_event_paranoid) does not allow are reported as n/a.
+*/
+#define BENCH_PERF(name, code, iterations) do { \
+    struct bench_run _bench_r; \
+    struct bench_perf _bench_perf; \
+    double _bench_harness[BENCH_PERF_EVENTS]; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_CLOCK, (uint64_t)(iterations), 0); \
+    _bench_run_perf_init(&_bench_r, &_bench_perf, _bench_harness); \
+    _BENCH_LOOP(CLOCK, code) \
+    _bench_run_perf_finish(&_bench_r, _bench_harness); \
+    _bench_run_finish(&_bench_r); \
+} while(0)
+
+#define BENCH_RDTSC_PERF(name, code, iterations) do { \
+    struct bench_run _bench_r; \
+    struct bench_perf _bench_perf; \
+    double _bench_harness[BENCH_PERF_EVENTS]; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_TSC, (uint64_t)(iterations), 0); \
+    _bench_run_perf_init(&_bench_r, &_bench_perf, _bench_harness); \
+    _BENCH_LOOP(TSC, code) \
+    _bench_run_perf_finish(&_bench_r, _bench_harness); \
+    _bench_run_finish(&_bench_r); \
+} while(0)
+
+/*
+* BENCH_RDPMC - measures core cycles (not reference cycles like
+* BENCH_RDTSC) and retired instructions per iteration with RDPMC from
+* user space, so turbo and downclocking do not distort the numbers. Reads
+* cost about as much as RDTSCP and need no syscall. Also reports IPC.
+*
+* Requires a PMU and kernel.perf_event_paranoid / rdpmc permissions that
+* allow user-space counter reads (/sys/bus/event_source/devices/cpu/rdpmc);
+* otherwise the run falls back to RDTSCP and says so. Single-threaded.
+* The block is expanded twice (RDPMC loop and fallback loop) so the timed
+* path carries no timer check.
+*/
+#define BENCH_RDPMC(name, code, iterations) do { \
+    struct bench_run _bench_r; \
+    _bench_run_init(&_bench_r, name, BENCH_TIMER_PMC, (uint64_t)(iterations), 0); \
+    if (_bench_r.res.timer == BENCH_TIMER_PMC) { \
+        _BENCH_LOOP(PMC, code) \
+    } else { \
+        _BENCH_LOOP(TSC, code) \
+    } \
+    _bench_run_finish(&_bench_r); \
+} while(0)
+
+/*
+* Multi-threaded runs. Every thread runs its own copy of the measurement
+* loop (warmup, statistics, recording) pinned to one allowed CPU; all of
+* them wait on a spin barrier between warmup and measurement, so the
+* measured phases overlap. Results are merged afterwards: latency
+* statistics and distributions over all samples, throughput over the
+* wall time from the first thread starting to the last one finishing.
+*
+* The thread body is a function void fn(void *ctx, struct bench_thread *t)
+* that wraps its measured block in BENCH_THREAD_LOOP(t, code); the
+* BENCH_THREADS / BENCH_SCALING macros build one from an inline block in
+* C++, the _FN variants take it as a plain function pointer in C.
+*/
+struct bench_thread {
+    int index;
+    int cpu;            /* CPU the thread was pinned to, -1 if pinning failed */
+    pthread_t handle;
+    struct bench_threads *group;
+    struct bench_result res; /* summarized; samples/histogram kept for merging */
+    uint64_t start_ns, end_ns;
+};
+
+struct bench_threads {
+    const char *name;
+    int timer;
+    uint64_t iterations;
+    int nthreads;
+    int report_threads;  /* also report every thread's own result */
+    double base_ops;     /* single-thread throughput to report speedup against, 0 if none */
+    int gate;            /* threads start once this is set */
+    struct bench_barrier barrier;
+    void (*fn)(void *ctx, struct bench_thread *t);
+    void *ctx;
+    struct bench_thread *threads;
+    char names[2][256];  /* aggregate and per-thread result names */
+};
+
+/* Prepares a group for bench_threads_run(); fn and ctx are set by the caller */
+static inline void bench_threads_init(struct bench_threads *g, const char *name, int timer,
+                                      uint64_t iterations, int nthreads) {
+    memset(g, 0, sizeof(*g));
+    g->name = name;
+    g->timer = timer;
+    g->iterations = iterations;
+    g->nthreads = nthreads > 0 ? nthreads : 1;
+    g->report_threads = 1;
+    if (bench_config.check_environment)
+        bench_check_environment();
+    _bench_sched_apply();
+    /* Calibrate process-wide caches here, not concurrently in the threads */
+    if (timer == BENCH_TIMER_TSC)
+        bench_tsc_ns_per_cycle();
+    bench_timer_floor(timer);
+}
+
+/* Called by a thread body before its loop (BENCH_THREAD_LOOP does it) */
+static inline void bench_thread_begin(struct bench_thread *t, struct bench_run *r) {
+    _bench_run_init(r, t->group->name, t->group->timer, t->group->iterations, 0);
+    r->barrier = &t->group->barrier;
+}
+
+/* Called by a thread body after its loop (BENCH_THREAD_LOOP does it) */
+static inline void bench_thread_end(struct bench_thread *t, struct bench_run *r) {
+    t->end_ns = _bench_clock_ns();
+    t->start_ns = r->auto_start_ns;
+    _bench_result_summarize(&r->res);
+    r->res.threads = 1;
+    r->res.pinned_cpu = t->cpu;
+    r->res.fifo = _bench_sched.fifo_active;
+    r->res.elapsed_ns = (double)(t->end_ns - t->start_ns);
+    t->res = r->res;
+}
+
+static inline void *_bench_thread_main(void *arg) {
+    struct bench_thread *_t = (struct bench_thread *)arg;
+    _bench_worker = 1;
+    _t->cpu = _bench_sched.ncpus ? _bench_sched.cpus[_t->index % _bench_sched.ncpus] : -1;
+    if (_t->cpu >= 0 && bench_pin_cpu(_t->cpu) != 0)
+        _t->cpu = -1;
+    while (!__atomic_load_n(&_t->group->gate, __ATOMIC_ACQUIRE))
+        sched_yield();
+    _t->group->fn(_t->group->ctx, _t);
+    return NULL;
+}
+
+/* Merges src into dst (Chan et al. for the streaming moments) */
+static inline void _bench_result_merge(struct bench_result *dst, const struct bench_result *src) {
+    uint64_t _n = dst->runs + src->runs;
+    if (!src->runs)
+        return;
+    double _delta = src->mean - dst->mean;
+    dst->m2 += src->m2 + _delta * _delta * (double)dst->runs * (double)src->runs / (double)_n;
+    dst->mean += _delta * (double)src->runs / (double)_n;
+    dst->runs = _n;
+    dst->total += src->total;
+    dst->min = src->min < dst->min ? src->min : dst->min;
+    dst->max = src->max > dst->max ? src->max : dst->max;
+    dst->warmup += src->warmup;
+    dst->threads += src->threads;
+    dst->migrated += src->migrated;
+    if (src->hist && dst->hist)
+        bench_hist_merge(dst->hist, src->hist);
+    if (src->nsamples && dst->samples) {
+        memcpy(dst->samples + dst->nsamples, src->samples, src->nsamples * sizeof(uint64_t));
+        dst->nsamples += src->nsamples;
+    }
+}
+
+/*
+* Runs g->fn on g->nthreads threads and reports the results: each
+* thread's own (when g->report_threads) and the aggregate "name [N threads]".
+* Returns the aggregate throughput in block executions per second.
+*/
+static inline double bench_threads_run(struct bench_threads *g) {
+    struct bench_thread *_t = (struct bench_thread *)calloc((size_t)g->nthreads, sizeof(struct bench_thread));
+    if (!_t)
+        return 0;
+    g->threads = _t;
+    g->gate = 0;
+    int _started = 0;
+    for (int _i = 0; _i < g->nthreads; _i++) {
+        _t[_i].index = _i;
+        _t[_i].group = g;
+        if (pthread_create(&_t[_i].handle, NULL, _bench_thread_main, &_t[_i]) != 0) {
+            fprintf(stderr, "bench: [%s] could only start %d of %d threads\n", g->name, _started, g->nthreads);
+            break;
+        }
+        _started++;
+    }
+    /* Size the barrier to the threads that exist before any of them can reach it */
+    g->barrier.count = (unsigned)_started;
+    g->barrier.arrived = 0;
+    __atomic_store_n(&g->gate, 1, __ATOMIC_RELEASE);
+    for (int _i = 0; _i < _started; _i++)
+        pthread_join(_t[_i].handle, NULL);
+
+    struct bench_result _agg;
+    memset(&_agg, 0, sizeof(_agg));
+    uint64_t _first = UINT64_MAX, _last = 0, _nsamples = 0;
+    int _hist = 1;
+    for (int _i = 0; _i < _started; _i++) {
+        _nsamples += _t[_i].res.nsamples;
+        _hist = _hist && _t[_i].res.hist;
+    }
+    _agg = _t[0].res;
+    snprintf(g->names[0], sizeof(g->names[0]), "%s [%d thread%s]", g->name, _started, _started == 1 ? "" : "s");
+    _agg.name = g->names[0];
+    _agg.runs = 0;
+    _agg.total = _agg.warmup = 0;
+    _agg.mean = _agg.m2 = 0;
+    _agg.min = UINT64_MAX;
+    _agg.max = 0;
+    _agg.threads = 0;
+    _agg.migrated = 0;
+    _agg.pinned_cpu = -1;
+    _agg.nsamples = 0;
+    _agg.samples = _nsamples ? (uint64_t *)malloc(_nsamples * sizeof(uint64_t)) : NULL;
+    _agg.hist = _hist && _started ? (struct bench_hist *)calloc(1, sizeof(struct bench_hist)) : NULL;
+    for (int _i = 0; _i < _started; _i++) {
+        _first = _t[_i].start_ns < _first ? _t[_i].start_ns : _first;
+        _last = _t[_i].end_ns > _last ? _t[_i].end_ns : _last;
+        _bench_result_merge(&_agg, &_t[_i].res);
+        if (g->report_threads) {
+            snprintf(g->names[1], sizeof(g->names[1]), "%s [thread %d, cpu %d]", g->name, _i, _t[_i].cpu);
+            _t[_i].res.name = g->names[1];
+            bench_emit(&_t[_i].res);
+        }
+        free(_t[_i].res.samples);
+        free(_t[_i].res.hist);
+    }
+    _agg.elapsed_ns = _last > _first ? (double)(_last - _first) : 0;
+    double _ops = bench_result_ops_per_sec(&_agg);
+    _agg.speedup = g->base_ops > 0 ? _ops / g->base_ops : 0;
+    if (_started)
+        _bench_result_finish(&_agg);
+    free(_t);
+    g->threads = NULL;
+    return _ops;
+}
+
+/*
+* BENCH_THREAD_LOOP - the measurement loop of thread t, timed with the
+* group's timer. Used as the body of a C thread function:
+*
+*   static void body(void *ctx, struct bench_thread *t) {
+*       struct queue *q = ctx;
+*       BENCH_THREAD_LOOP(t, { queue_push(q, 1); });
+*   }
+*   ...
+*   BENCH_THREADS_FN("push", body, &q, BENCH_AUTO_ITERATIONS, 4);
+*/
+#define BENCH_THREAD_LOOP(t, code) do { \
+    struct bench_run _bench_r; \
+    bench_thread_begin(t, &_bench_r); \
+    if (_bench_r.res.timer == BENCH_TIMER_TSC) { \
+        _BENCH_LOOP(TSC, code) \
+    } else { \
+        _BENCH_LOOP(CLOCK, code) \
+    } \
+    bench_thread_end(t, &_bench_r); \
+} while(0)
+
+/*
+* Runs fn(ctx, t) on nthreads threads as one group; returns the aggregate
+* throughput in block executions per second
+*/
+static inline double _bench_threads(const char *name, int timer, uint64_t iterations, int nthreads,
+                                    void (*fn)(void *ctx, struct bench_thread *t), void *ctx) {
+    struct bench_threads _g;
+    bench_threads_init(&_g, name, timer, iterations, nthreads);
+    _g.fn = fn;
+    _g.ctx = ctx;
+    return bench_threads_run(&_g);
+}
+
+/*
+* Thread body built from an inline block: a lambda in C++, called through
+* _BENCH_THREAD_FN / _BENCH_THREAD_CTX. C has no closures short of GCC
+* nested functions, whose stack trampolines would need an executable
+* stack, so C code passes a function to the _FN macros instead.
+*/
+#ifdef __cplusplus
+template <class F> static inline void _bench_thread_call(void *ctx, struct bench_thread *t) {
+    (*static_cast<F *>(ctx))(t);
+}
+
+#define _BENCH_THREAD_BODY(TIMER, code) \
+    auto _bench_body = [&](struct bench_thread *_bench_t) { \
+        struct bench_run _bench_r; \
+        bench_thread_begin(_bench_t, &_bench_r); \
+        _BENCH_LOOP(TIMER, code) \
+        bench_thread_end(_bench_t, &_bench_r); \
+    };
+#define _BENCH_THREAD_FN _bench_thread_call<decltype(_bench_body)>
+#define _BENCH_THREAD_CTX (&_bench_body)
+#else
+#define _BENCH_THREAD_BODY(TIMER, code) \
+    _Static_assert(0, "bench.h: inline multi-threaded blocks need C++; in C use the _FN macros with BENCH_THREAD_LOOP");
+#define _BENCH_THREAD_FN NULL
+#define _BENCH_THREAD_CTX NULL
+#endif
+
+/*
+* BENCH_THREADS / BENCH_RDTSC_THREADS - run the block on nthreads pinned
+* threads at once and time it in each. Reports every thread's latency
+* statistics and the aggregate over all of them, with total throughput.
+* Shared state used by the block must be thread-safe. Link with -pthread.
+* C++ only; see BENCH_THREADS_FN for C.
+*/
+#define BENCH_THREADS(name, code, iterations, nthreads) do { \
+    _BENCH_THREAD_BODY(CLOCK, code) \
+    _bench_threads(name, BENCH_TIMER_CLOCK, (uint64_t)(iterations), (int)(nthreads), \
+                   _BENCH_THREAD_FN, _BENCH_THREAD_CTX); \
+} while(0)
+
+#define BENCH_RDTSC_THREADS(name, code, iterations, nthreads) do { \
+    _BENCH_THREAD_BODY(TSC, code) \
+    _bench_threads(name, BENCH_TIMER_TSC, (uint64_t)(iterations), (int)(nthreads), \
+                   _BENCH_THREAD_FN, _BENCH_THREAD_CTX); \
+} while(0)
+
+/*
+* BENCH_THREADS_FN / BENCH_RDTSC_THREADS_FN - as BENCH_THREADS, with the
+* thread body given as void fn(void *ctx, struct bench_thread *t) built
+* on BENCH_THREAD_LOOP; ctx is passed to every thread. Works in C and C++.
+*/
+#define BENCH_THREADS_FN(name, fn, ctx, iterations, nthreads) \
+    _bench_threads(name, BENCH_TIMER_CLOCK, (uint64_t)(iterations), (int)(nthreads), fn, ctx)
+
+#define BENCH_RDTSC_THREADS_FN(name, fn, ctx, iterations, nthreads) \
+    _bench_threads(name, BENCH_TIMER_TSC, (uint64_t)(iterations), (int)(nthreads), fn, ctx)
+
+/*
+* Thread scaling sweeps. The block runs at 1, 2, 4, ... threads up to a
+* maximum (the online CPUs by default, always included), and throughput
+* at each count is compared with the single-thread run. Two models are
+* fitted by least squares on the speedups S(N):
+*   Amdahl: S = 1 / (s + (1 - s) / N), s the serial fraction;
+*   USL:    S = N / (1 + a (N - 1) + b N (N - 1)), a contention and b
+*           coherency cost, which also predicts a peak at sqrt((1 - a) / b).
+*/
+#ifndef BENCH_SCALING_MAX_STEPS
+#define BENCH_SCALING_MAX_STEPS 32
+#endif
+
+struct bench_scaling {
+    const char *name;
+    double bytes, items;  /* declared work, reapplied before every step */
+    int steps;
+    int threads[BENCH_SCALING_MAX_STEPS];
+    double ops[BENCH_SCALING_MAX_STEPS];   /* block executions per second, 0 if the step failed */
+    int amdahl_valid;
+    double amdahl_serial;
+    int usl_valid;
+    double usl_contention, usl_coherency;
+};
+
+static inline void _bench_scaling_init(struct bench_scaling *s, const char *name, int max_threads) {
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->bytes = _bench_work_bytes;
+    s->items = _bench_work_items;
+    if (max_threads <= 0)
+        max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads <= 0)
+        max_threads = 1;
+    for (int _n = 1; _n < max_threads && s->steps < BENCH_SCALING_MAX_STEPS - 1; _n *= 2)
+        s->threads[s->steps++] = _n;
+    s->threads[s->steps++] = max_threads;
+}
+
+/* Fits both models to the measured steps */
+static inline void bench_scaling_fit(struct bench_scaling *s) {
+    /* Amdahl: 1/S - 1/N = s (1 - 1/N), one parameter through the origin */
+    double _xx = 0, _xy = 0;
+    /* USL: N/S - 1 = a (N - 1) + b N (N - 1), two parameters through the origin */
+    double _uu = 0, _uv = 0, _vv = 0, _uy = 0, _vy = 0;
+    int _points = 0;
+    for (int _i = 1; _i < s->steps; _i++) {
+        if (s->ops[_i] <= 0 || s->ops[0] <= 0)
+            continue;
+        double _n = s->threads[_i], _speedup = s->ops[_i] / s->ops[0];
+        double _x = 1 - 1 / _n, _y = 1 / _speedup - 1 / _n;
+        _xx += _x * _x;
+        _xy += _x * _y;
+        double _u = _n - 1, _v = _n * (_n - 1), _w = _n / _speedup - 1;
+        _uu += _u * _u;
+        _uv += _u * _v;
+        _vv += _v * _v;
+        _uy += _u * _w;
+        _vy += _v * _w;
+        _points++;
+    }
+    if (_points >= 1 && _xx > 0) {
+        s->amdahl_serial = fmin(fmax(_xy / _xx, 0), 1);
+        s->amdahl_valid = 1;
+    }
+    double _det = _uu * _vv - _uv * _uv;
+    if (_points >= 2 && _det > 0) {
+        s->usl_contention = fmax((_uy * _vv - _vy * _uv) / _det, 0);
+        s->usl_coherency = fmax((_vy * _uu - _uy * _uv) / _det, 0);
+        s->usl_valid = 1;
+    }
+}
+
+/* Prints the sweep as a table followed by the fitted models */
+static inline void bench_scaling_print(FILE *out, const struct bench_scaling *s) {
+    fprintf(out, "[%s scaling]\n", s->name);
+    fprintf(out, "%8s %14s %9s %11s\n", "Threads", "ops/s", "Speedup", "Efficiency");
+    for (int _i = 0; _i < s->steps; _i++) {
+        if (s->ops[_i] <= 0) {
+            fprintf(out, "%8d %14s\n", s->threads[_i], "failed");
+            continue;
+        }
+        double _speedup = s->ops[0] > 0 ? s->ops[_i] / s->ops[0] : 0;
+        fprintf(out, "%8d %14.4g %8.2fx %10.0f%%\n", s->threads[_i], s->ops[_i], _speedup,
+                100.0 * _speedup / s->threads[_i]);
+    }
+    if (s->amdahl_valid) {
+        fprintf(out, "Amdahl   serial fraction %.2f%%", 100.0 * s->amdahl_serial);
+        if (s->amdahl_serial > 0)
+            fprintf(out, ", speedup limit %.3gx", 1 / s->amdahl_serial);
+        fputc('\n', out);
+    }
+    if (s->usl_valid) {
+        fprintf(out, "USL      contention %.4f, coherency %.6f", s->usl_contention, s->usl_coherency);
+        if (s->usl_coherency > 0 && s->usl_contention < 1) {
+            double _peak = sqrt((1 - s->usl_contention) / s->usl_coherency);
+            fprintf(out, ", peak at %.1f threads (%.3gx)", _peak,
+                    _peak / (1 + s->usl_contention * (_peak - 1) + s->usl_coherency * _peak * (_peak - 1)));
+        }
+        fputc('\n', out);
+    }
+    fputc('\n', out);
+}
+
+/*
+* Stream for summaries spanning several results (sweeps, fits): the text
+* report, or stderr when a structured reporter owns the output.
+*/
+static inline FILE *_bench_summary_output(void) {
+    return _bench_output && strcmp(_bench_output_reporter->name, "text") == 0 ? _bench_output : stderr;
+}
+
+/* Fits and prints the sweep; structured reports carry the per-step fields instead */
+static inline void _bench_scaling_finish(struct bench_scaling *s) {
+    bench_scaling_fit(s);
+    bench_scaling_print(_bench_summary_output(), s);
+}
+
+/* Runs the sweep with fn(ctx, t) as the thread body */
+static inline void _bench_scaling(const char *name, int timer, uint64_t iterations, int max_threads,
+                                  void (*fn)(void *ctx, struct bench_thread *t), void *ctx) {
+    struct bench_scaling _s;
+    _bench_scaling_init(&_s, name, max_threads);
+    for (int _i = 0; _i < _s.steps; _i++) {
+        struct bench_threads _g;
+        _bench_work_bytes = _s.bytes;
+        _bench_work_items = _s.items;
+        bench_threads_init(&_g, name, timer, iterations, _s.threads[_i]);
+        _g.report_threads = 0;
+        _g.base_ops = _i ? _s.ops[0] : 0;
+        _g.fn = fn;
+        _g.ctx = ctx;
+        _s.ops[_i] = bench_threads_run(&_g);
+    }
+    _bench_scaling_finish(&_s);
+}
+
+/*
+* BENCH_SCALING / BENCH_RDTSC_SCALING - multi-threaded runs of the block
+* at 1, 2, 4, ... threads up to max_threads (0: online CPUs), each
+* reported as with BENCH_THREADS, then a throughput / speedup /
+* efficiency table with Amdahl and USL fits. C++ only; see
+* BENCH_SCALING_FN for C.
+*/
+#define BENCH_SCALING(name, code, iterations, max_threads) do { \
+    _BENCH_THREAD_BODY(CLOCK, code) \
+    _bench_scaling(name, BENCH_TIMER_CLOCK, (uint64_t)(iterations), (int)(max_threads), \
+                   _BENCH_THREAD_FN, _BENCH_THREAD_CTX); \
+} while(0)
+
+#define BENCH_RDTSC_SCALING(name, code, iterations, max_threads) do { \
+    _BENCH_THREAD_BODY(TSC, code) \
+    _bench_scaling(name, BENCH_TIMER_TSC, (uint64_t)(iterations), (int)(max_threads), \
+                   _BENCH_THREAD_FN, _BENCH_THREAD_CTX); \
+} while(0)
+
+/* BENCH_SCALING_FN / BENCH_RDTSC_SCALING_FN - sweeps with a thread function, as BENCH_THREADS_FN */
+#define BENCH_SCALING_FN(name, fn, ctx, iterations, max_threads) \
+    _bench_scaling(name, BENCH_TIMER_CLOCK, (uint64_t)(iterations), (int)(max_threads), fn, ctx)
+
+#define BENCH_RDTSC_SCALING_FN(name, fn, ctx, iterations, max_threads) \
+    _bench_scaling(name, BENCH_TIMER_TSC, (uint64_t)(iterations), (int)(max_threads), fn, ctx)
+
+/*
+* Parameterized benchmarks. The block runs once per value of a parameter
+* taken from lo, lo * mult, lo * mult^2, ... up to hi (always included),
+* or per pair of values of two such ranges, and every value is its own
+* result named "name/value" ("name/value1/value2"). Over a single range
+* the mean times are fitted against common complexity classes,
+* t(n) = c * g(n), by least squares; the class with the smallest RMS
+* error relative to the mean time is reported.
+*/
+#ifndef BENCH_RANGE_MAX_STEPS
+#define BENCH_RANGE_MAX_STEPS 64
+#endif
+
+#define BENCH_O_1      0
+#define BENCH_O_LOG_N  1
+#define BENCH_O_N      2
+#define BENCH_O_N_LOG_N 3
+#define BENCH_O_N2     4
+#define BENCH_O_N3     5
+#define BENCH_O_COUNT  6
+
+static const char *const bench_complexity_names[BENCH_O_COUNT] = {
+    "O(1)", "O(log n)", "O(n)", "O(n log n)", "O(n^2)", "O(n^3)",
+};
+
+static inline double bench_complexity_g(int o, double n) {
+    switch (o) {
+    case BENCH_O_LOG_N: return log2(n);
+    case BENCH_O_N: return n;
+    case BENCH_O_N_LOG_N: return n * log2(n);
+    case BENCH_O_N2: return n * n;
+    case BENCH_O_N3: return n * n * n;
+    default: return 1;
+    }
+}
+
+struct bench_range {
+    const char *name;
+    int timer;
+    double bytes, items;  /* declared work, reapplied before every value */
+    int steps;
+    uint64_t values[BENCH_RANGE_MAX_STEPS];
+    double time[BENCH_RANGE_MAX_STEPS]; /* mean per execution in timer units, single range only */
+    int best;             /* BENCH_O_* with the smallest RMS, -1 before fitting */
+    double coef[BENCH_O_COUNT], rms[BENCH_O_COUNT];
+    char result_name[256];
+};
+
+/* Fills values with lo, lo * mult, ... up to hi (0, 1, mult, ... from 0); returns the count */
+static inline int bench_range_values(uint64_t *values, int max, uint64_t lo, uint64_t hi, uint64_t mult) {
+    int _n = 0;
+    mult = mult < 2 ? 2 : mult;
+    if (lo == 0 && hi > 0 && max > 1) {
+        values[_n++] = 0;
+        lo = 1;
+    }
+    for (uint64_t _v = lo; _v < hi && _n < max - 1; _v = _v > UINT64_MAX / mult ? hi : _v * mult)
+        values[_n++] = _v;
+    values[_n++] = hi;
+    return _n;
+}
+
+static inline void _bench_range_init(struct bench_range *rg, const char *name, int timer,
+                                     uint64_t lo, uint64_t hi, uint64_t mult) {
+    memset(rg, 0, sizeof(*rg));
+    rg->name = name;
+    rg->timer = timer;
+    rg->bytes = _bench_work_bytes;
+    rg->items = _bench_work_items;
+    rg->steps = bench_range_values(rg->values, BENCH_RANGE_MAX_STEPS, lo, hi, mult);
+    rg->best = -1;
+}
+
+/* Names the next result and restores the declared work */
+static inline const char *_bench_range_begin(struct bench_range *rg, const uint64_t *values, int nvalues) {
+    int _len = snprintf(rg->result_name, sizeof(rg->result_name), "%s", rg->name);
+    for (int _i = 0; _i < nvalues && _len < (int)sizeof(rg->result_name); _i++)
+        _len += snprintf(rg->result_name + _len, sizeof(rg->result_name) - _len, "/%lu", values[_i]);
+    _bench_work_bytes = rg->bytes;
+    _bench_work_items = rg->items;
+    return rg->result_name;
+}
+
+/* Fits every complexity class to the mean times; needs two or more sizes above zero */
+static inline void bench_range_fit(struct bench_range *rg) {
+    double _mean = 0;
+    int _points = 0;
+    for (int _i = 0; _i < rg->steps; _i++) {
+        if (rg->values[_i] == 0 || rg->time[_i] <= 0)
+            continue;
+        _mean += rg->time[_i];
+        _points++;
+    }
+    if (_points < 2)
+        return;
+    _mean /= _points;
+    for (int _o = 0; _o < BENCH_O_COUNT; _o++) {
+        double _gg = 0, _gt = 0, _err = 0;
+        for (int _i = 0; _i < rg->steps; _i++) {
+            if (rg->values[_i] == 0 || rg->time[_i] <= 0)
+                continue;
+            double _g = bench_complexity_g(_o, (double)rg->values[_i]);
+            _gg += _g * _g;
+            _gt += _g * rg->time[_i];
+        }
+        rg->coef[_o] = _gg > 0 ? _gt / _gg : 0;
+        for (int _i = 0; _i < rg->steps; _i++) {
+            if (rg->values[_i] == 0 || rg->time[_i] <= 0)
+                continue;
+            double _d = rg->time[_i] - rg->coef[_o] * bench_complexity_g(_o, (double)rg->values[_i]);
+            _err += _d * _d;
+        }
+        rg->rms[_o] = sqrt(_err / _points) / _mean;
+        if (rg->best < 0 || rg->rms[_o] < rg->rms[rg->best])
+            rg->best = _o;
+    }
+}
+
+/* Prints the size / time curve and the complexity fit */
+static inline void bench_range_print(FILE *out, const struct bench_range *rg) {
+    const char *_unit = bench_timer_unit(rg->timer);
+    fprintf(out, "[%s complexity]\n", rg->name);
+    fprintf(out, "%14s %14s\n", "n", _unit);
+    for (int _i = 0; _i < rg->steps; _i++)
+        fprintf(out, "%14lu %14.2f\n", rg->values[_i], rg->time[_i]);
+    if (rg->best >= 0) {
+        static const char *const _terms[BENCH_O_COUNT] = { "1", "log n", "n", "n log n", "n^2", "n^3" };
+        fprintf(out, "Fit      %s: %.4g %s * %s, RMS %.1f%%\n", bench_complexity_names[rg->best],
+                rg->coef[rg->best], _unit, _terms[rg->best], 100.0 * rg->rms[rg->best]);
+        fprintf(out, "Others  ");
+        for (int _o = 0; _o < BENCH_O_COUNT; _o++)
+            if (_o != rg->best)
+                fprintf(out, " %s %.1f%%", bench_complexity_names[_o], 100.0 * rg->rms[_o]);
+        fputc('\n', out);
+    }
+    fputc('\n', out);
+}
+
+#define _BENCH_RANGE(name, TIMER, var, lo, hi, mult, code, iterations) do { \
+    struct bench_range _bench_range; \
+    _bench_range_init(&_bench_range, name, BENCH_TIMER_##TIMER, (uint64_t)(lo), (uint64_t)(hi), (uint64_t)(mult)); \
+    for (int _bench_step = 0; _bench_step < _bench_range.steps; _bench_step++) { \
+        const uint64_t var = _bench_range.values[_bench_step]; \
+        struct bench_run _bench_r; \
+        _bench_run_init(&_bench_r, _bench_range_begin(&_bench_range, &var, 1), BENCH_TIMER_##TIMER, \
+                        (uint64_t)(iterations), 0); \
+        _BENCH_LOOP(TIMER, code) \
+        _bench_run_finish(&_bench_r); \
+        _bench_range.time[_bench_step] = bench_result_avg(&_bench_r.res); \
     } \
-    \
-    printf("[%s]\nAvg     %7.2f cycles\nMin     %6lu\nMax     %6lu\nRuns     %d\n\n", \
-           name, \
-           (double)_bench_total / iterations, \
-           _bench_min, \
-           _bench_max, \
-           iterations); \
+    bench_range_fit(&_bench_range); \
+    bench_range_print(_bench_summary_output(), &_bench_range); \
 } while(0)
 
+#define _BENCH_RANGE2(name, TIMER, var1, lo1, hi1, mult1, var2, lo2, hi2, mult2, code, iterations) do { \
+    struct bench_range _bench_range; \
+    uint64_t _bench_inner[BENCH_RANGE_MAX_STEPS]; \
+    int _bench_ninner = bench_range_values(_bench_inner, BENCH_RANGE_MAX_STEPS, \
+                                           (uint64_t)(lo2), (uint64_t)(hi2), (uint64_t)(mult2)); \
+    _bench_range_init(&_bench_range, name, BENCH_TIMER_##TIMER, (uint64_t)(lo1), (uint64_t)(hi1), (uint64_t)(mult1)); \
+    for (int _bench_step = 0; _bench_step < _bench_range.steps * _bench_ninner; _bench_step++) { \
+        const uint64_t var1 = _bench_range.values[_bench_step / _bench_ninner]; \
+        const uint64_t var2 = _bench_inner[_bench_step % _bench_ninner]; \
+        const uint64_t _bench_pair[2] = { var1, var2 }; \
+        struct bench_run _bench_r; \
+        _bench_run_init(&_bench_r, _bench_range_begin(&_bench_range, _bench_pair, 2), BENCH_TIMER_##TIMER, \
+                        (uint64_t)(iterations), 0); \
+        _BENCH_LOOP(TIMER, code) \
+        _bench_run_finish(&_bench_r); \
+    } \
+} while(0)
+
+/*
+* BENCH_RANGE / BENCH_RDTSC_RANGE - run the block for every value of
+* var (a const uint64_t visible in the block) from lo to hi, multiplying
+* by mult: BENCH_RANGE("sum", n, 64, 1 << 20, 2, { sum(buf, n); }, 1000)
+* reports "sum/64", "sum/128", ..., then a size/time table with the
+* fitted complexity class.
+*
+* BENCH_RANGE2 / BENCH_RDTSC_RANGE2 - the cartesian product of two such
+* ranges, one result per pair ("name/v1/v2"); no complexity fit.
+*
+* Work declared with bench_set_bytes() / bench_set_items() applies to
+* every value.
+*/
+#define BENCH_RANGE(name, var, lo, hi, mult, code, iterations) \
+    _BENCH_RANGE(name, CLOCK, var, lo, hi, mult, code, iterations)
+
+#define BENCH_RDTSC_RANGE(name, var, lo, hi, mult, code, iterations) \
+    _BENCH_RANGE(name, TSC, var, lo, hi, mult, code, iterations)
+
+#define BENCH_RANGE2(name, var1, lo1, hi1, mult1, var2, lo2, hi2, mult2, code, iterations) \
+    _BENCH_RANGE2(name, CLOCK, var1, lo1, hi1, mult1, var2, lo2, hi2, mult2, code, iterations)
+
+#define BENCH_RDTSC_RANGE2(name, var1, lo1, hi1, mult1, var2, lo2, hi2, mult2, code, iterations) \
+    _BENCH_RANGE2(name, TSC, var1, lo1, hi1, mult1, var2, lo2, hi2, mult2, code, iterations)
+
+/*
+* Cold-cache runs. Between executions, outside the timed region, the
+* caches are evicted: the ranges declared with bench_cold_range() are
+* flushed line by line with CLFLUSH, or, with none declared, a scratch
+* buffer of BENCH_COLD_LLC_FACTOR times the last-level cache is streamed
+* through so earlier data is pushed out. The block is measured hot first
+* and cold second; the cold result carries the cold / hot mean ratio.
+*/
+#ifndef BENCH_COLD_RANGES
+#define BENCH_COLD_RANGES 16
+#endif
+
+#ifndef BENCH_COLD_LLC_FACTOR
+#define BENCH_COLD_LLC_FACTOR 2
+#endif
+
+/* Used when the last-level cache size cannot be read */
+#ifndef BENCH_COLD_DEFAULT_LLC
+#define BENCH_COLD_DEFAULT_LLC (32u << 20)
+#endif
+
+struct bench_cold {
+    const void *ptr[BENCH_COLD_RANGES];
+    size_t len[BENCH_COLD_RANGES];
+    int nranges;
+    unsigned char *scratch;  /* allocated on first use, kept for the process */
+    size_t scratch_len;
+};
+
+_BENCH_SHARED struct bench_cold _bench_cold;
+
+/* Declares memory the next cold run flushes between executions; cleared once it has reported */
+static inline void bench_cold_range(const void *ptr, size_t len) {
+    if (_bench_cold.nranges == BENCH_COLD_RANGES) {
+        fprintf(stderr, "bench: more than %d cold ranges, ignoring %p\n", BENCH_COLD_RANGES, ptr);
+        return;
+    }
+    _bench_cold.ptr[_bench_cold.nranges] = ptr;
+    _bench_cold.len[_bench_cold.nranges++] = len;
+}
+
+/* Size of the last-level cache in bytes, BENCH_COLD_DEFAULT_LLC if unknown */
+static inline size_t bench_llc_size(void) {
+    size_t _best = 0;
+    for (int _i = 0; _i < 8; _i++) {
+        char _path[64], _buf[32];
+        snprintf(_path, sizeof(_path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", _i);
+        FILE *_f = fopen(_path, "r");
+        if (!_f)
+            break;
+        if (fgets(_buf, sizeof(_buf), _f)) {
+            char *_end;
+            size_t _size = strtoul(_buf, &_end, 10);
+            _size <<= *_end == 'K' ? 10 : *_end == 'M' ? 20 : *_end == 'G' ? 30 : 0;
+            _best = _size > _best ? _size : _best;
+        }
+        fclose(_f);
+    }
+    return _best ? _best : BENCH_COLD_DEFAULT_LLC;
+}
+
+/* Evicts the declared ranges, or the whole cache hierarchy as far as streaming can */
+static inline void bench_evict_caches(void) {
+    if (_bench_cold.nranges) {
+        for (int _r = 0; _r < _bench_cold.nranges; _r++) {
+            const char *_p = (const char *)((uintptr_t)_bench_cold.ptr[_r] & ~(uintptr_t)63);
+            const char *_end = (const char *)_bench_cold.ptr[_r] + _bench_cold.len[_r];
+            for (; _p < _end; _p += 64)
+                asm volatile ("clflush %0" : : "m" (*_p));
+        }
+        asm volatile ("mfence" ::: "memory");
+        return;
+    }
+    if (!_bench_cold.scratch) {
+        size_t _len = BENCH_COLD_LLC_FACTOR * bench_llc_size();
+        _bench_cold.scratch = (unsigned char *)malloc(_len);
+        if (!_bench_cold.scratch) {
+            fprintf(stderr, "bench: cannot allocate %zu bytes to evict caches\n", _len);
+            return;
+        }
+        memset(_bench_cold.scratch, 1, _len);
+        _bench_cold.scratch_len = _len;
+    }
+    /* Writes leave the lines dirty, so the evicted data also loses its clean copies */
+    for (size_t _i = 0; _i < _bench_cold.scratch_len; _i += 64)
+        _bench_cold.scratch[_i]++;
+    bench_clobber_memory();
+}
+
+#define _BENCH_COLD(name, TIMER, code, iterations) do { \
+    char _bench_cold_name[2][256]; \
+    double _bench_hot_mean = 0, _bench_bytes = _bench_work_bytes, _bench_items = _bench_work_items; \
+    snprintf(_bench_cold_name[0], sizeof(_bench_cold_name[0]), "%s (hot)", name); \
+    snprintf(_bench_cold_name[1], sizeof(_bench_cold_name[1]), "%s (cold)", name); \
+    for (int _bench_cold_pass = 0; _bench_cold_pass < 2; _bench_cold_pass++) { \
+        struct bench_run _bench_r; \
+        _bench_work_bytes = _bench_bytes; \
+        _bench_work_items = _bench_items; \
+        _bench_run_init(&_bench_r, _bench_cold_name[_bench_cold_pass], BENCH_TIMER_##TIMER, \
+                        (uint64_t)(iterations), 0); \
+        _BENCH_LOOP_SETUP(TIMER, if (_bench_cold_pass) bench_evict_caches(), code, ) \
+        if (_bench_cold_pass && _bench_hot_mean > 0) \
+            _bench_r.res.cold_ratio = bench_result_avg(&_bench_r.res) / _bench_hot_mean; \
+        else \
+            _bench_hot_mean = bench_result_avg(&_bench_r.res); \
+        _bench_run_finish(&_bench_r); \
+    } \
+    _bench_cold.nranges = 0; \
+} while(0)
+
+/*
+* BENCH_COLD / BENCH_RDTSC_COLD - measure the block with hot caches, then
+* with caches evicted before every execution; reported as "name (hot)"
+* and "name (cold)". Declare the data the block touches with
+* bench_cold_range() to flush just that (cheap), otherwise each
+* execution is preceded by streaming twice the LLC size, so keep
+* iteration counts modest. Instruction caches and TLBs are evicted only
+* by streaming, and only partially.
+*/
+#define BENCH_COLD(name, code, iterations) _BENCH_COLD(name, CLOCK, code, iterations)
+
+#define BENCH_RDTSC_COLD(name, code, iterations) _BENCH_COLD(name, TSC, code, iterations)
+
 #endif // BENCH_H